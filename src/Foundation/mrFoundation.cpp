@@ -1,7 +1,10 @@
 ﻿#include "pch.h"
 #include "mrInternal.h"
+#include <intrin.h>
+#include <immintrin.h>
 
 #pragma comment(lib, "shcore.lib")
+#pragma comment(lib, "winmm.lib")
 
 namespace mr {
 
@@ -111,32 +114,10 @@ const char* Scan(const std::string& str, const std::regex& exp, const std::funct
 
 const char* ScanKVP(const char* s, const std::function<void(std::string k, std::string v)>& body)
 {
-    auto ex_key = std::regex(R"((\w+)\s*:\s*)");
-    auto ex_value = std::regex(R"(^([^ ]+))");
-    auto ex_parenthesis = std::regex(R"(^\{([^}]+)\})");
-    std::cmatch match;
-    for (;;) {
-        std::regex_search(s, match, ex_key);
-        if (!match.empty()) {
-            std::string key, value;
-            key = match.str(1);
-            s += match.position() + match.length();
-
-            if (std::regex_search(s, match, ex_parenthesis) || std::regex_search(s, match, ex_value)) {
-                value = match.str(1);
-                s += match.position() + match.length();
-
-                body(key, value);
-            }
-            else {
-                break;
-            }
-        }
-        else {
-            break;
-        }
-    }
-    return s;
+    auto rest = ForEachKVP(s, [&body](std::string_view k, std::string_view v) {
+        body(std::string(k), std::string(v));
+        });
+    return rest.data();
 }
 
 const char* ScanKVP(const std::string& str, const std::function<void(std::string k, std::string v)>& body)
@@ -213,6 +194,132 @@ float Timer::elapsed() const
 }
 
 
+DeadlineTimer::DeadlineTimer()
+{
+    // high resolution waitable timer is available on Windows 10 1803 or later.
+    // it wakes up within ~0.5ms, so spinning the last 1ms is enough.
+    m_timer = ::CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    m_spin_margin = 1000000;
+    if (!m_timer) {
+        // fallback: regular timer with 1ms system timer resolution. see waitUntil()
+        m_timer = ::CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+        m_raise_period = true;
+        m_spin_margin = 2000000;
+    }
+    m_cancel_event = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    m_wake_event = ::CreateEventW(nullptr, FALSE, FALSE, nullptr);
+}
+
+DeadlineTimer::~DeadlineTimer()
+{
+    if (m_timer)
+        ::CloseHandle(m_timer);
+    if (m_cancel_event)
+        ::CloseHandle(m_cancel_event);
+    if (m_wake_event)
+        ::CloseHandle(m_wake_event);
+}
+
+bool DeadlineTimer::waitUntil(nanosec deadline)
+{
+    nanosec now = NowNS();
+    if (m_timer && m_cancel_event && m_wake_event && deadline > now + m_spin_margin) {
+        // negative due time is relative, in 100ns units
+        LARGE_INTEGER due;
+        due.QuadPart = -LONGLONG((deadline - now - m_spin_margin) / 100);
+        if (::SetWaitableTimerEx(m_timer, &due, 0, nullptr, nullptr, nullptr, 0)) {
+            // the system timer resolution is raised only while sleeping, so idle timers don't keep it at 1ms
+            bool period_changed = m_raise_period && ::timeBeginPeriod(1) == TIMERR_NOERROR;
+            HANDLE handles[] = { m_cancel_event, m_wake_event, m_timer };
+            auto r = ::WaitForMultipleObjects(3, handles, FALSE, INFINITE);
+            if (period_changed)
+                ::timeEndPeriod(1);
+            if (r == WAIT_OBJECT_0)
+                return false;
+            else if (r == WAIT_OBJECT_0 + 1) {
+                m_woken = false;
+                return true;
+            }
+        }
+    }
+    while (NowNS() < deadline) {
+        if (m_canceled)
+            return false;
+        if (m_woken.exchange(false))
+            return true;
+        YieldProcessor();
+    }
+    return !m_canceled;
+}
+
+void DeadlineTimer::wake()
+{
+    m_woken = true;
+    if (m_wake_event)
+        ::SetEvent(m_wake_event);
+}
+
+void DeadlineTimer::cancel()
+{
+    m_canceled = true;
+    if (m_cancel_event)
+        ::SetEvent(m_cancel_event);
+}
+
+void DeadlineTimer::reset()
+{
+    m_canceled = false;
+    if (m_cancel_event)
+        ::ResetEvent(m_cancel_event);
+}
+
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char* path)
+{
+    close();
+    m_file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size{};
+    ::GetFileSizeEx(m_file, &size);
+    if (size.QuadPart == 0) {
+        // empty files can't be mapped
+        close();
+        return false;
+    }
+
+    m_mapping = ::CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping)
+        m_data = (const byte*)::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) {
+        close();
+        return false;
+    }
+    m_size = (size_t)size.QuadPart;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data)
+        ::UnmapViewOfFile(m_data);
+    if (m_mapping)
+        ::CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        ::CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = nullptr;
+    m_data = nullptr;
+    m_size = 0;
+}
+
+
 ProfileTimer::ProfileTimer(const char* mes, ...)
 {
     va_list args;
@@ -231,6 +338,107 @@ ProfileTimer::~ProfileTimer()
 }
 
 
+static const size_t kHostMemoryAlign = 64;
+static const size_t kLargeAllocationSize = 2 * 1024 * 1024;
+
+// large pages require SeLockMemoryPrivilege. try to enable it once and give up if it is not granted.
+static size_t GetLargePageSize()
+{
+    static size_t s_size = []() -> size_t {
+        size_t size = ::GetLargePageMinimum();
+        if (size == 0)
+            return 0;
+
+        HANDLE token{};
+        if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+            return 0;
+        TOKEN_PRIVILEGES tp{};
+        tp.PrivilegeCount = 1;
+        tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        bool ok = ::LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid) &&
+            ::AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr) &&
+            ::GetLastError() == ERROR_SUCCESS; // AdjustTokenPrivileges() succeeds even if the privilege is not assigned
+        ::CloseHandle(token);
+        return ok ? size : 0;
+    }();
+    return s_size;
+}
+
+void* AllocHostMemory(size_t size)
+{
+    if (size >= kLargeAllocationSize) {
+        // VirtualAlloc() is page aligned. the decision depends only on size so that FreeHostMemory() can tell which one was used.
+        void* ret = nullptr;
+        if (size_t page = GetLargePageSize())
+            ret = ::VirtualAlloc(nullptr, ceildiv(size, page) * page, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (!ret)
+            ret = ::VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (!ret)
+            throw std::bad_alloc();
+        return ret;
+    }
+    else {
+        void* ret = ::_aligned_malloc(size, kHostMemoryAlign);
+        if (!ret)
+            throw std::bad_alloc();
+        return ret;
+    }
+}
+
+void FreeHostMemory(void* p, size_t size)
+{
+    if (!p)
+        return;
+    if (size >= kLargeAllocationSize)
+        ::VirtualFree(p, 0, MEM_RELEASE);
+    else
+        ::_aligned_free(p);
+}
+
+
+// F16C instructions are VEX encoded. the OS must also support AVX state.
+static bool HasF16C()
+{
+    static const bool s_has = []() {
+        int info[4]{};
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        bool f16c = (info[2] & (1 << 29)) != 0;
+        return osxsave && avx && f16c && (_xgetbv(0) & 0x6) == 0x6;
+    }();
+    return s_has;
+}
+
+void FloatToHalf(half* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+    if (HasF16C()) {
+        for (; i + 8 <= n; i += 8) {
+            __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128((__m128i*)(dst + i), h);
+        }
+        _mm256_zeroupper();
+    }
+    for (; i < n; ++i)
+        dst[i] = half(src[i]);
+}
+
+void HalfToFloat(float* dst, const half* src, size_t n)
+{
+    size_t i = 0;
+    if (HasF16C()) {
+        for (; i + 8 <= n; i += 8) {
+            __m256 f = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i)));
+            _mm256_storeu_ps(dst + i, f);
+        }
+        _mm256_zeroupper();
+    }
+    for (; i < n; ++i)
+        dst[i] = src[i].to_float();
+}
+
+
 static std::vector<std::function<void()>>& GetInitializeHandlers()
 {
     static std::vector<std::function<void()>> s_obj;
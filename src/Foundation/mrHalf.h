@@ -4,7 +4,8 @@
 
 namespace mr {
 
-// note: this half doesn't care about Inf nor NaN. simply round down minor bits of exponent and mantissa.
+// IEEE 754 binary16. rounds to nearest even, handles denormals, Inf and NaN.
+// FloatToHalf() / HalfToFloat() below convert arrays much faster if F16C is available.
 struct half
 {
     uint16_t value;
@@ -16,10 +17,28 @@ struct half
     {
         uint32_t n = (uint32_t&)v;
         uint16_t sign_bit = (n >> 16) & 0x8000;
-        uint16_t exponent = (std::max<int>((n >> 23) - 127 + 15, 0) & 0x1f) << 10;
-        uint16_t mantissa = (n >> (23 - 10)) & 0x3ff;
-
-        value = sign_bit | exponent | mantissa;
+        uint32_t a = n & 0x7fffffff;
+
+        if (a >= 0x7f800000) {
+            // Inf or NaN. keep NaN quiet
+            value = sign_bit | 0x7c00 | (a > 0x7f800000 ? 0x200 : 0);
+        }
+        else if (a >= 0x477ff000) {
+            // >= 65520 rounds to Inf
+            value = sign_bit | 0x7c00;
+        }
+        else if (a < 0x38800000) {
+            // denormal or zero. adding 0.5 makes float's ulp equal to half's denormal ulp (2^-24), and FPU does the rounding.
+            float f = (float&)a + 0.5f;
+            value = sign_bit | uint16_t((uint32_t&)f - 0x3f000000);
+        }
+        else {
+            // rebias exponent and round mantissa to nearest even
+            uint32_t odd = (a >> 13) & 1;
+            a -= (127 - 15) << 23;
+            a += 0xfff + odd;
+            value = sign_bit | uint16_t(a >> 13);
+        }
     }
 
     half& operator=(float v)
@@ -31,9 +50,21 @@ struct half
     float to_float() const
     {
         uint32_t sign_bit = (value & 0x8000) << 16;
-        uint32_t exponent = ((((value >> 10) & 0x1f) - 15 + 127) & 0xff) << 23;
-        uint32_t mantissa = (value & 0x3ff) << (23 - 10);
-        uint32_t r = sign_bit | exponent | mantissa;
+        uint32_t exponent = (value >> 10) & 0x1f;
+        uint32_t mantissa = value & 0x3ff;
+        uint32_t r;
+        if (exponent == 0x1f) {
+            // Inf or NaN
+            r = sign_bit | 0x7f800000 | (mantissa << 13);
+        }
+        else if (exponent == 0) {
+            // denormal or zero
+            float f = float(mantissa) * (1.0f / 16777216.0f);
+            r = sign_bit | (uint32_t&)f;
+        }
+        else {
+            r = sign_bit | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        }
         return (float&)r;
     }
     operator float() const { return to_float(); }
@@ -42,6 +73,11 @@ struct half
     static half one() { return half(1.0f); }
 };
 
+// bulk conversion. uses F16C (vcvtps2ph / vcvtph2ps) if the CPU supports it, otherwise falls back to half's scalar conversion.
+// results are the same either way.
+void FloatToHalf(half* dst, const float* src, size_t n);
+void HalfToFloat(float* dst, const half* src, size_t n);
+
 
 float clamp01(float v);
 float clamp11(float v);
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace mr {
+
+// lock-free triple buffer for single producer & single consumer.
+// the producer writes to the back buffer and publish() it without ever blocking.
+// the consumer update() to get the newest published buffer. intermediate buffers are skipped if the consumer is slow.
+template<class T>
+class TripleBuffer
+{
+public:
+    // producer side
+    T& back() { return m_buffers[m_back]; }
+
+    void publish()
+    {
+        // exchange back and middle. dirty bit tells the consumer that middle has new contents.
+        uint32_t prev = m_middle.exchange(m_back | DirtyBit, std::memory_order_acq_rel);
+        m_back = prev & IndexMask;
+    }
+
+    // consumer side
+    // returns true if front buffer has been updated.
+    bool update()
+    {
+        if ((m_middle.load(std::memory_order_relaxed) & DirtyBit) == 0)
+            return false;
+        uint32_t prev = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = prev & IndexMask;
+        return true;
+    }
+
+    T& front() { return m_buffers[m_front]; }
+    const T& front() const { return m_buffers[m_front]; }
+
+private:
+    static constexpr uint32_t IndexMask = 0x3;
+    static constexpr uint32_t DirtyBit = 0x4;
+
+    T m_buffers[3]{};
+    uint32_t m_back = 0;
+    std::atomic<uint32_t> m_middle{ 1 };
+    uint32_t m_front = 2;
+};
+
+} // namespace mr
@@ -1857,3 +1857,5 @@ inline float3 offset_ray(const float3 p, const float3 n)
 }
 
 } // namespace mr
+
+#include "mrVectorSIMD.h"
@@ -0,0 +1,269 @@
+#pragma once
+// SIMD overloads for float4, int4 and float4x4.
+// these are plain (non-template) overloads of the generic ones in mrVector.h, so they are preferred by overload resolution
+// while memory layout and API stay the same. in constant evaluation they fall back to the scalar path.
+
+#include <type_traits>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define mrSIMD_SSE
+    #include <emmintrin.h>
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+    #define mrSIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+#if defined(mrSIMD_SSE) || defined(mrSIMD_NEON)
+namespace mr {
+namespace simd {
+
+#ifdef mrSIMD_SSE
+using f4 = __m128;
+using i4 = __m128i;
+
+inline f4 load(const float4& v) { return _mm_loadu_ps(&v.x); }
+inline i4 load(const int4& v) { return _mm_loadu_si128((const __m128i*)&v.x); }
+inline f4 set1(float v) { return _mm_set1_ps(v); }
+inline i4 set1(int v) { return _mm_set1_epi32(v); }
+inline float4 store(f4 v) { float4 r; _mm_storeu_ps(&r.x, v); return r; }
+inline int4 store(i4 v) { int4 r; _mm_storeu_si128((__m128i*)&r.x, v); return r; }
+
+inline f4 add(f4 a, f4 b) { return _mm_add_ps(a, b); }
+inline f4 sub(f4 a, f4 b) { return _mm_sub_ps(a, b); }
+inline f4 mul(f4 a, f4 b) { return _mm_mul_ps(a, b); }
+inline f4 div(f4 a, f4 b) { return _mm_div_ps(a, b); }
+inline f4 min(f4 a, f4 b) { return _mm_min_ps(a, b); }
+inline f4 max(f4 a, f4 b) { return _mm_max_ps(a, b); }
+inline f4 sqrt(f4 a) { return _mm_sqrt_ps(a); }
+inline f4 abs(f4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline f4 neg(f4 a) { return _mm_xor_ps(_mm_set1_ps(-0.0f), a); }
+inline float hsum(f4 a)
+{
+    f4 t = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+    return _mm_cvtss_f32(t);
+}
+
+inline i4 add(i4 a, i4 b) { return _mm_add_epi32(a, b); }
+inline i4 sub(i4 a, i4 b) { return _mm_sub_epi32(a, b); }
+inline i4 mul(i4 a, i4 b)
+{
+    // _mm_mullo_epi32 is SSE4.1. emulate with two 32x32->64 multiplies
+    i4 even = _mm_mul_epu32(a, b);
+    i4 odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+inline i4 select(i4 mask, i4 a, i4 b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+inline i4 min(i4 a, i4 b) { return select(_mm_cmplt_epi32(a, b), a, b); }
+inline i4 max(i4 a, i4 b) { return select(_mm_cmpgt_epi32(a, b), a, b); }
+inline i4 neg(i4 a) { return _mm_sub_epi32(_mm_setzero_si128(), a); }
+inline i4 abs(i4 a) { return max(a, neg(a)); }
+#endif // mrSIMD_SSE
+
+#ifdef mrSIMD_NEON
+using f4 = float32x4_t;
+using i4 = int32x4_t;
+
+inline f4 load(const float4& v) { return vld1q_f32(&v.x); }
+inline i4 load(const int4& v) { return vld1q_s32(&v.x); }
+inline f4 set1(float v) { return vdupq_n_f32(v); }
+inline i4 set1(int v) { return vdupq_n_s32(v); }
+inline float4 store(f4 v) { float4 r; vst1q_f32(&r.x, v); return r; }
+inline int4 store(i4 v) { int4 r; vst1q_s32(&r.x, v); return r; }
+
+inline f4 add(f4 a, f4 b) { return vaddq_f32(a, b); }
+inline f4 sub(f4 a, f4 b) { return vsubq_f32(a, b); }
+inline f4 mul(f4 a, f4 b) { return vmulq_f32(a, b); }
+inline f4 div(f4 a, f4 b) { return vdivq_f32(a, b); }
+inline f4 min(f4 a, f4 b) { return vminq_f32(a, b); }
+inline f4 max(f4 a, f4 b) { return vmaxq_f32(a, b); }
+inline f4 sqrt(f4 a) { return vsqrtq_f32(a); }
+inline f4 abs(f4 a) { return vabsq_f32(a); }
+inline f4 neg(f4 a) { return vnegq_f32(a); }
+inline float hsum(f4 a) { return vaddvq_f32(a); }
+
+inline i4 add(i4 a, i4 b) { return vaddq_s32(a, b); }
+inline i4 sub(i4 a, i4 b) { return vsubq_s32(a, b); }
+inline i4 mul(i4 a, i4 b) { return vmulq_s32(a, b); }
+inline i4 min(i4 a, i4 b) { return vminq_s32(a, b); }
+inline i4 max(i4 a, i4 b) { return vmaxq_s32(a, b); }
+inline i4 neg(i4 a) { return vnegq_s32(a); }
+inline i4 abs(i4 a) { return vabsq_s32(a); }
+#endif // mrSIMD_NEON
+
+// m[0] * v.x + m[1] * v.y + m[2] * v.z + m[3] * v.w. same as the generic one.
+inline f4 mul(const float4x4& m, const float4& v)
+{
+    auto r = mul(load(m[0]), set1(v.x));
+    r = add(r, mul(load(m[1]), set1(v.y)));
+    r = add(r, mul(load(m[2]), set1(v.z)));
+    r = add(r, mul(load(m[3]), set1(v.w)));
+    return r;
+}
+
+} // namespace simd
+
+
+#define mrSIMDBinary(V, S, Op, F)\
+    inline constexpr V operator Op(const V& l, const V& r)\
+    {\
+        if (std::is_constant_evaluated()) return { l.x Op r.x, l.y Op r.y, l.z Op r.z, l.w Op r.w };\
+        return simd::store(simd::F(simd::load(l), simd::load(r)));\
+    }\
+    inline constexpr V operator Op(const V& l, S r)\
+    {\
+        if (std::is_constant_evaluated()) return { l.x Op r, l.y Op r, l.z Op r, l.w Op r };\
+        return simd::store(simd::F(simd::load(l), simd::set1(r)));\
+    }\
+    inline constexpr V operator Op(S l, const V& r)\
+    {\
+        if (std::is_constant_evaluated()) return { l Op r.x, l Op r.y, l Op r.z, l Op r.w };\
+        return simd::store(simd::F(simd::set1(l), simd::load(r)));\
+    }\
+    inline constexpr V& operator Op##=(V& l, const V& r) { l = l Op r; return l; }\
+    inline constexpr V& operator Op##=(V& l, S r) { l = l Op r; return l; }
+
+#define mrSIMDFunc2(V, F)\
+    inline constexpr V F(const V& a, const V& b)\
+    {\
+        if (std::is_constant_evaluated()) return { std::F(a.x, b.x), std::F(a.y, b.y), std::F(a.z, b.z), std::F(a.w, b.w) };\
+        return simd::store(simd::F(simd::load(a), simd::load(b)));\
+    }
+
+mrSIMDBinary(float4, float, +, add)
+mrSIMDBinary(float4, float, -, sub)
+mrSIMDBinary(float4, float, *, mul)
+mrSIMDBinary(float4, float, /, div)
+mrSIMDFunc2(float4, min)
+mrSIMDFunc2(float4, max)
+
+mrSIMDBinary(int4, int, +, add)
+mrSIMDBinary(int4, int, -, sub)
+mrSIMDBinary(int4, int, *, mul)
+mrSIMDFunc2(int4, min)
+mrSIMDFunc2(int4, max)
+
+#undef mrSIMDBinary
+#undef mrSIMDFunc2
+
+// in constant evaluation, these call the generic templates explicitly.
+// generic matrix ops index with operator[], which can't be constant evaluated. matrix ops use members instead, in the same order of operations as the SIMD path.
+inline constexpr float4 operator-(const float4& v)
+{
+    if (std::is_constant_evaluated()) return operator-<float>(v);
+    return simd::store(simd::neg(simd::load(v)));
+}
+inline constexpr int4 operator-(const int4& v)
+{
+    if (std::is_constant_evaluated()) return operator-<int>(v);
+    return simd::store(simd::neg(simd::load(v)));
+}
+inline constexpr float4 abs(const float4& v)
+{
+    if (std::is_constant_evaluated()) return abs<float>(v);
+    return simd::store(simd::abs(simd::load(v)));
+}
+inline constexpr int4 abs(const int4& v)
+{
+    if (std::is_constant_evaluated()) return abs<int>(v);
+    return simd::store(simd::abs(simd::load(v)));
+}
+inline constexpr float4 sqrt(const float4& v)
+{
+    if (std::is_constant_evaluated()) return sqrt<float>(v);
+    return simd::store(simd::sqrt(simd::load(v)));
+}
+
+inline constexpr float4 clamp(const float4& v, const float4& vmin, const float4& vmax)
+{
+    if (std::is_constant_evaluated()) return clamp<float>(v, vmin, vmax);
+    return simd::store(simd::min(simd::max(simd::load(v), simd::load(vmin)), simd::load(vmax)));
+}
+inline constexpr float4 lerp(const float4& a, const float4& b, float t)
+{
+    if (std::is_constant_evaluated()) return lerp<float>(a, b, t);
+    auto va = simd::load(a);
+    return simd::store(simd::add(va, simd::mul(simd::sub(simd::load(b), va), simd::set1(t))));
+}
+inline constexpr float dot(const float4& l, const float4& r)
+{
+    if (std::is_constant_evaluated()) return dot<float>(l, r);
+    return simd::hsum(simd::mul(simd::load(l), simd::load(r)));
+}
+inline constexpr float sum(const float4& v)
+{
+    if (std::is_constant_evaluated()) return sum<float>(v);
+    return simd::hsum(simd::load(v));
+}
+
+inline constexpr float4 operator*(const float4x4& m, const float4& v)
+{
+    if (std::is_constant_evaluated()) return m.m[0] * v.x + m.m[1] * v.y + m.m[2] * v.z + m.m[3] * v.w;
+    return simd::store(simd::mul(m, v));
+}
+inline constexpr float4x4 operator*(const float4x4& a, const float4x4& b)
+{
+    // row i of result = sum of (a[i][k] * b[k])
+    float4x4 r{};
+    if (std::is_constant_evaluated()) {
+        for (int i = 0; i < 4; ++i)
+            r.m[i] = b.m[0] * a.m[i].x + b.m[1] * a.m[i].y + b.m[2] * a.m[i].z + b.m[3] * a.m[i].w;
+        return r;
+    }
+    for (int i = 0; i < 4; ++i) {
+        auto v = simd::mul(simd::set1(a[i][0]), simd::load(b[0]));
+        v = simd::add(v, simd::mul(simd::set1(a[i][1]), simd::load(b[1])));
+        v = simd::add(v, simd::mul(simd::set1(a[i][2]), simd::load(b[2])));
+        v = simd::add(v, simd::mul(simd::set1(a[i][3]), simd::load(b[3])));
+        r[i] = simd::store(v);
+    }
+    return r;
+}
+inline constexpr float4x4& operator*=(float4x4& a, const float4x4& b) { a = a * b; return a; }
+
+
+// bulk operations. dst can be same as src.
+inline void add_array(float4* dst, const float4* a, const float4* b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = simd::store(simd::add(simd::load(a[i]), simd::load(b[i])));
+}
+inline void mul_array(float4* dst, const float4* a, const float4* b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = simd::store(simd::mul(simd::load(a[i]), simd::load(b[i])));
+}
+inline void mul_array(float4* dst, const float4* a, float b, size_t n)
+{
+    auto vb = simd::set1(b);
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = simd::store(simd::mul(simd::load(a[i]), vb));
+}
+// dst = a * b + c
+inline void mad_array(float4* dst, const float4* a, const float4& b, const float4* c, size_t n)
+{
+    auto vb = simd::load(b);
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = simd::store(simd::add(simd::mul(simd::load(a[i]), vb), simd::load(c[i])));
+}
+inline void transform_array(float4* dst, const float4x4& m, const float4* src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = simd::store(simd::mul(m, src[i]));
+}
+
+} // namespace mr
+
+#else // no SIMD
+
+namespace mr {
+
+inline void add_array(float4* dst, const float4* a, const float4* b, size_t n) { for (size_t i = 0; i < n; ++i) dst[i] = a[i] + b[i]; }
+inline void mul_array(float4* dst, const float4* a, const float4* b, size_t n) { for (size_t i = 0; i < n; ++i) dst[i] = a[i] * b[i]; }
+inline void mul_array(float4* dst, const float4* a, float b, size_t n) { for (size_t i = 0; i < n; ++i) dst[i] = a[i] * b; }
+inline void mad_array(float4* dst, const float4* a, const float4& b, const float4* c, size_t n) { for (size_t i = 0; i < n; ++i) dst[i] = a[i] * b + c[i]; }
+inline void transform_array(float4* dst, const float4x4& m, const float4* src, size_t n) { for (size_t i = 0; i < n; ++i) dst[i] = m * src[i]; }
+
+} // namespace mr
+
+#endif
@@ -2,7 +2,10 @@ cbuffer Constants : register(b0)
 {
     float g_radius;
     float g_strength;
-    int2 g_pad;
+    float g_threshold; // Contour_Binary only
+    int g_pad;
+    int2 g_offset; // region. the image is read only inside it
+    int2 g_end;
 };
 
 Texture2D<float> g_image : register(t0);
@@ -11,23 +14,24 @@ RWTexture2D<float> g_result : register(u0);
 [numthreads(32, 32, 1)]
 void main(uint2 tid : SV_DispatchThreadID)
 {
-    uint w, h;
-    g_image.GetDimensions(w, h);
+    int2 pos = int2(tid) + g_offset;
+    if (any(pos >= g_end))
+        return;
 
     int radius = int(g_radius);
-    int2 ul = max(int2(tid) - radius, 0);
-    int2 br = min(int2(tid) + radius + 1, int2(w, h));
+    int2 ul = max(pos - radius, g_offset);
+    int2 br = min(pos + radius + 1, g_end);
 
     float cmin, cmax;
-    cmin = cmax = g_image[tid];
+    cmin = cmax = g_image[pos];
     for (int i = ul.y; i < br.y; ++i) {
         for (int j = ul.x; j < br.x; ++j) {
-            if (distance(float2(tid), float2(j, i)) <= g_radius) {
+            if (distance(float2(pos), float2(j, i)) <= g_radius) {
                 float c = g_image[uint2(j, i)];
                 cmin = min(c, cmin);
                 cmax = max(c, cmax);
             }
         }
     }
-    g_result[tid] = saturate((cmax - cmin) * g_strength);
+    g_result[pos] = saturate((cmax - cmin) * g_strength);
 }
@@ -0,0 +1,52 @@
+cbuffer Constants : register(b0)
+{
+    float g_radius;
+    float g_strength;
+    float g_threshold;
+    int g_pad;
+    int2 g_offset; // region. x is multiple of 32. the image is read only inside it
+    int2 g_end;
+};
+
+Texture2D<float> g_image : register(t0);
+RWTexture2D<uint> g_result : register(u0);
+
+// Contour.hlsl + Binarize.hlsl in one pass. used when the grayscale contour itself is not needed.
+float Contour(int2 pos)
+{
+    int radius = int(g_radius);
+    int2 ul = max(pos - radius, g_offset);
+    int2 br = min(pos + radius + 1, g_end);
+
+    float cmin, cmax;
+    cmin = cmax = g_image[pos];
+    for (int i = ul.y; i < br.y; ++i) {
+        for (int j = ul.x; j < br.x; ++j) {
+            if (distance(float2(pos), float2(j, i)) <= g_radius) {
+                float c = g_image[uint2(j, i)];
+                cmin = min(c, cmin);
+                cmax = max(c, cmax);
+            }
+        }
+    }
+    // quantize as Contour.hlsl writing to Ru8, so the result is same as contour & binarize in separate passes
+    return round(saturate((cmax - cmin) * g_strength) * 255.0f) / 255.0f;
+}
+
+[numthreads(1, 32, 1)]
+void main(uint2 tid : SV_DispatchThreadID)
+{
+    int2 base = int2(tid.x * 32, tid.y) + g_offset;
+    if (base.y >= g_end.y)
+        return;
+
+    uint r = 0;
+    for (int i = 0; i < 32; ++i) {
+        int2 pos = base + int2(i, 0);
+        if (pos.x < g_end.x) {
+            if (Contour(pos) > g_threshold)
+                r |= (1 << i);
+        }
+    }
+    g_result[uint2(base.x / 32, base.y)] = r;
+}
@@ -1,7 +1,8 @@
 cbuffer Constants : register(b0)
 {
     float g_radius; // assume < 16
-    int3 g_pad;
+    uint g_width;   // actual width in pixels. bits beyond this are padding and kept zero.
+    int2 g_pad;
 };
 
 Texture2D<uint> g_image : register(t0);
@@ -26,8 +27,10 @@ void main(uint2 tid : SV_DispatchThreadID)
     uint r = 0;
     for (uint b = 0; b < 32; ++b) {
         uint bx = tid.x * 32 + b;
+        if (bx >= g_width)
+            break;
         uint left = max(int(bx) - radius, 0);
-        uint right = min(bx + radius + 1, w * 32);
+        uint right = min(bx + radius + 1, g_width);
 
         uint px = left / 32;
         uint shift = left % 32;
@@ -28,19 +28,21 @@ groupshared uint s_mask[CacheCapacity];
 [numthreads(32, 32, 1)]
 void main(uint2 tid : SV_DispatchThreadID, uint gi : SV_GroupIndex)
 {
-    // template_size.x is divided by 32 as the image is binary and the texture format is uint32.
-    // g_template_size.x is actual width.
+    // the image is binary and the texture format is uint32. rows are padded (see GetBinaryRowWords()).
+    // g_template_size.x is actual width. tw is the number of words that actually have pixels.
+    // padding guarantees image[px + 1] is always inside the row, and template & mask are zero beyond the width.
 
-     uint2 template_size, mask_size;
+    uint2 template_size, mask_size;
     g_template.GetDimensions(template_size.x, template_size.y);
     g_mask.GetDimensions(mask_size.x, mask_size.y);
 
-    const uint tw = template_size.x;
+    const uint tw = (g_template_size.x + 31) / 32;
     const uint th = template_size.y;
 
     const uint px_offset = (g_tl.x + tid.x) / 32;
     const uint bit_shift = (g_tl.x + tid.x) % 32;
-    const uint edge_mask = (1 << (g_template_size.x % 32)) - 1;
+    const uint edge_bits = g_template_size.x % 32;
+    const uint edge_mask = edge_bits == 0 ? 0xffffffff : (1u << edge_bits) - 1;
     const uint cache_height = CacheCapacity / tw;
     const uint cache_size = cache_height * tw;
 
@@ -69,9 +71,7 @@ void main(uint2 tid : SV_DispatchThreadID, uint gi : SV_GroupIndex)
                 uint iv = lshift(g_image[uint2(px, py)], g_image[uint2(px + 1, py)], bit_shift);
                 uint tv = s_template[tw * cy + j];
                 uint bits = iv ^ tv;
-                if (j == tw - 1)
-                    bits &= edge_mask;
-                r += countbits(bits);
+                r += countbits(j == tw - 1 ? bits & edge_mask : bits);
             }
         }
     }
@@ -99,11 +99,8 @@ void main(uint2 tid : SV_DispatchThreadID, uint gi : SV_GroupIndex)
                 uint px = px_offset + j;
                 uint iv = lshift(g_image[uint2(px, py)], g_image[uint2(px + 1, py)], bit_shift);
                 uint tv = s_template[tw * cy + j];
-                uint bits = iv ^ tv;
-                if (j == tw - 1)
-                    bits &= edge_mask;
                 uint mask = s_mask[tw * cy + j];
-                r += countbits(bits & mask);
+                r += countbits((iv ^ tv) & mask);
             }
         }
     }
@@ -121,12 +118,13 @@ void main(uint2 tid : SV_DispatchThreadID)
     g_template.GetDimensions(template_size.x, template_size.y);
     g_mask.GetDimensions(mask_size.x, mask_size.y);
 
-    const uint tw = template_size.x;
+    const uint tw = (g_template_size.x + 31) / 32;
     const uint th = template_size.y;
 
     const uint px_offset = (g_tl.x + tid.x) / 32;
     const uint bit_shift = (g_tl.x + tid.x) % 32;
-    const uint edge_mask = (1 << (g_template_size.x % 32)) - 1;
+    const uint edge_bits = g_template_size.x % 32;
+    const uint edge_mask = edge_bits == 0 ? 0xffffffff : (1u << edge_bits) - 1;
 
     uint r = 0;
     if (template_size.x != mask_size.x) {
@@ -138,9 +136,7 @@ void main(uint2 tid : SV_DispatchThreadID)
                 uint iv = lshift(g_image[uint2(px, py)], g_image[uint2(px + 1, py)], bit_shift);
                 uint tv = g_template[uint2(j, i)];
                 uint bits = iv ^ tv;
-                if (j == tw - 1)
-                    bits &= edge_mask;
-                r += countbits(bits);
+                r += countbits(j == tw - 1 ? bits & edge_mask : bits);
             }
         }
     }
@@ -152,11 +148,8 @@ void main(uint2 tid : SV_DispatchThreadID)
                 uint px = px_offset + j;
                 uint iv = lshift(g_image[uint2(px, py)], g_image[uint2(px + 1, py)], bit_shift);
                 uint tv = g_template[uint2(j, i)];
-                uint bits = iv ^ tv;
-                if (j == tw - 1)
-                    bits &= edge_mask;
                 uint mask = g_mask[uint2(j, i)];
-                r += countbits(bits & mask);
+                r += countbits((iv ^ tv) & mask);
             }
         }
     }
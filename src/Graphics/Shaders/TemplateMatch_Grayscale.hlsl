@@ -4,6 +4,8 @@ cbuffer Constants : register(b0)
     uint2 g_tl;
     uint2 g_br;
     uint2 g_template_size;
+    float g_result_scale;   // 1 / template area if dst is Rf16. otherwise 1
+    int3 g_pad;
 };
 
 Texture2D<float> g_image : register(t0);
@@ -97,7 +99,7 @@ void main(uint2 tid : SV_DispatchThreadID, uint gi : SV_GroupIndex)
     }
 
     if (tid.x < g_range.x && tid.y < g_range.y)
-        g_result[tid] = r;
+        g_result[tid] = r * g_result_scale;
 }
 
 #else // EnableGroupShared
@@ -140,7 +142,7 @@ void main(uint2 tid : SV_DispatchThreadID)
     }
 
     if (tid.x < g_range.x && tid.y < g_range.y)
-        g_result[tid] = r;
+        g_result[tid] = r * g_result_scale;
 }
 
 #endif // EnableGroupShared
@@ -11,6 +11,8 @@ cbuffer Constants : register(b0)
     float2 g_bias;
     uint g_flags;
     uint g_filter;
+    uint2 g_dst_offset; // dst region
+    uint2 g_dst_end;
     uint2 g_pad;
 };
 
@@ -24,7 +26,11 @@ SamplerState g_sampler_linear : register(s1);
 [numthreads(32, 32, 1)]
 void main(uint2 tid : SV_DispatchThreadID)
 {
-    float2 uv = (g_sample_step * float2(tid)) + g_pixel_offset + (g_sample_step * 0.5f);
+    uint2 pos = tid + g_dst_offset;
+    if (any(pos >= g_dst_end))
+        return;
+
+    float2 uv = (g_sample_step * float2(pos)) + g_pixel_offset + (g_sample_step * 0.5f);
     float4 p;
     switch (g_filter) {
     case 0: p = SampleTexture1x1(g_src, g_sampler_linear, uv); break;
@@ -39,11 +45,11 @@ void main(uint2 tid : SV_DispatchThreadID)
 
     if (g_flags & F_Grayscale) {
         float c = dot(p.rgb, float3(0.2126f, 0.7152f, 0.0722f));
-        g_dst[tid] = saturate((c - g_bias.x) * g_bias.y);
+        g_dst[pos] = saturate((c - g_bias.x) * g_bias.y);
     }
     else {
         if (g_flags & F_FillAlpha)
             p.a = 1.0f;
-        g_dst[tid] = saturate((p - g_bias.x) * g_bias.y);
+        g_dst[pos] = saturate((p - g_bias.x) * g_bias.y);
     }
 }
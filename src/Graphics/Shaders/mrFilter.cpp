@@ -7,6 +7,7 @@
 #include "Normalize_I.hlsl.h"
 #include "Binarize.hlsl.h"
 #include "Contour.hlsl.h"
+#include "Contour_Binary.hlsl.h"
 #include "Expand_Grayscale.hlsl.h"
 #include "Expand_Binary.hlsl.h"
 #include "TemplateMatch_Grayscale.hlsl.h"
@@ -37,6 +38,31 @@ public:
 template<class T> void FilterCommon<T>::setSrc(ITexture2DPtr v) { m_src = cast(v); }
 template<class T> void FilterCommon<T>::setDst(ITexture2DPtr v) { m_dst = cast(v); }
 
+// region of dst actually written. empty region means entire dst.
+// Binary is processed in words, so x is extended to 32 pixel boundaries.
+static Rect GetWriteRegion(Texture2D& dst, Rect region)
+{
+    int2 size = dst.getSize();
+    if (region.size == int2::zero())
+        return Rect{ {}, size };
+
+    region = region.intersect(Rect{ {}, size });
+    if (dst.getFormat() == TextureFormat::Binary) {
+        int x0 = region.pos.x / 32 * 32;
+        int x1 = std::min(ceildiv(region.pos.x + region.size.x, 32) * 32, size.x);
+        region = Rect{ { x0, region.pos.y }, { x1 - x0, region.size.y } };
+    }
+    return region;
+}
+
+// number of words to dispatch for a Binary dst. if region reaches the right edge, padding words are written (as zero) too.
+static int GetWordCount(Texture2D& dst, Rect region)
+{
+    int end = region.pos.x + region.size.x;
+    int end_word = end >= dst.getSize().x ? dst.getInternalSize().x : ceildiv(end, 32);
+    return end_word - region.pos.x / 32;
+}
+
 
 class Transform : public FilterCommon<ITransform>
 {
@@ -52,6 +78,7 @@ public:
     void setSrc(ITexture2DPtr v) override;
     void setDst(ITexture2DPtr v) override;
     void setSrcRegion(Rect v) override;
+    void setDstRegion(Rect v) override;
     void setColorRange(float2 v) override;
     void setGrayscale(bool v) override;
     void setFillAlpha(bool v) override;
@@ -63,6 +90,8 @@ public:
     BufferPtr m_const;
 
     Rect m_region{};
+    Rect m_dst_region{};
+    Rect m_write_region{};
     float2 m_color_range{ 0.0f, 1.0f };
     bool m_grayscale = false;
     bool m_fill_alpha = false;
@@ -74,6 +103,7 @@ Transform::Transform(TransformCS* v) : m_cs(v) {}
 void Transform::setSrc(ITexture2DPtr v) { mrCheckDirty(m_src.get() == v.get()); super::setSrc(v); }
 void Transform::setDst(ITexture2DPtr v) { mrCheckDirty(m_dst.get() == v.get()); super::setDst(v); }
 void Transform::setSrcRegion(Rect v) { mrCheckDirty(m_region == v); m_region = v; }
+void Transform::setDstRegion(Rect v) { mrCheckDirty(m_dst_region == v); m_dst_region = v; }
 void Transform::setColorRange(float2 v) { mrCheckDirty(m_color_range == v); m_color_range = v; }
 void Transform::setGrayscale(bool v) { mrCheckDirty(m_grayscale == v); m_grayscale = v; }
 void Transform::setFillAlpha(bool v) { mrCheckDirty(m_fill_alpha == v); m_fill_alpha = v; }
@@ -86,6 +116,12 @@ void Transform::dispatch()
         return;
     }
 
+    auto region = GetWriteRegion(*m_dst, m_dst_region);
+    if (region != m_write_region) {
+        m_write_region = region;
+        m_dirty = true;
+    }
+
     if (m_dirty) {
         int2 src_size = m_src->getSize();
         int2 dst_size = m_dst->getSize();
@@ -99,12 +135,16 @@ void Transform::dispatch()
             float2 bias;
             uint32_t flags;
             int filter;
+            int2 dst_offset;
+            int2 dst_end;
             int2 pad;
         } params{};
         params.pixel_size = 1.0f / float2(src_size);
         params.pixel_offset = params.pixel_size * m_region.pos;
         params.sample_step = (float2(size) / float2(src_size)) / float2(dst_size);
         params.bias = float2{ m_color_range.x, 1.0f / (m_color_range.y - m_color_range.x) };
+        params.dst_offset = m_write_region.pos;
+        params.dst_end = m_write_region.pos + m_write_region.size;
         if (m_grayscale)
             set_flag(params.flags, Flag::Grayscale, true);
         if (m_fill_alpha)
@@ -119,7 +159,7 @@ void Transform::dispatch()
             else if (dst_size.x < src_size.x / 1) params.filter = 2;
         }
 
-        m_const = Buffer::createConstant(params);
+        Buffer::updateConstant(m_const, params);
         m_dirty = false;
     }
     m_cs->dispatch(*this);
@@ -140,10 +180,10 @@ void TransformCS::dispatch(ICSContext& ctx)
     m_cs.setSRV(c.m_src);
     m_cs.setUAV(c.m_dst);
 
-    auto dst_size = c.m_dst->getInternalSize();
+    auto size = c.m_write_region.size;
     m_cs.dispatch(
-        ceildiv(dst_size.x, 32),
-        ceildiv(dst_size.y, 32));
+        ceildiv(size.x, 32),
+        ceildiv(size.y, 32));
 }
 
 ITransformPtr TransformCS::createContext()
@@ -187,7 +227,7 @@ void Normalize::dispatch()
         } params{};
         params.rmax = m_rmax;
 
-        m_const = Buffer::createConstant(params);
+        Buffer::updateConstant(m_const, params);
         m_dirty = false;
     }
 
@@ -225,6 +265,7 @@ class Binarize : public FilterCommon<IBinarize>
 public:
     Binarize(BinarizeCS* v);
     void setThreshold(float v) override;
+    void setRegion(Rect v) override;
     void dispatch() override;
 
 public:
@@ -232,6 +273,8 @@ public:
     BufferPtr m_const;
 
     float m_threshold = 0.5f;
+    Rect m_region{};
+    Rect m_write_region{};
     bool m_dirty = true;
 };
 
@@ -242,6 +285,7 @@ IBinarizePtr BinarizeCS::createContext()
 
 Binarize::Binarize(BinarizeCS* v) : m_cs(v) {}
 void Binarize::setThreshold(float v) { mrCheckDirty(v == m_threshold); m_threshold = v; }
+void Binarize::setRegion(Rect v) { m_region = v; }
 
 void Binarize::dispatch()
 {
@@ -250,15 +294,25 @@ void Binarize::dispatch()
         return;
     }
 
+    auto region = GetWriteRegion(*m_dst, m_region);
+    if (region != m_write_region) {
+        m_write_region = region;
+        m_dirty = true;
+    }
+
     if (m_dirty) {
         struct
         {
             float threshold;
             int3 pad;
+            int2 offset;
+            int2 end;
         } params{};
         params.threshold = m_threshold;
+        params.offset = m_write_region.pos;
+        params.end = m_write_region.pos + m_write_region.size;
 
-        m_const = Buffer::createConstant(params);
+        Buffer::updateConstant(m_const, params);
         m_dirty = false;
     }
 
@@ -278,10 +332,10 @@ void BinarizeCS::dispatch(ICSContext& ctx)
     m_cs.setUAV(c.m_dst);
     m_cs.setCBuffer(c.m_const);
 
-    auto size = c.m_dst->getInternalSize();
+    auto& region = c.m_write_region;
     m_cs.dispatch(
-        size.x,
-        ceildiv(size.y, 32));
+        GetWordCount(*c.m_dst, region),
+        ceildiv(region.size.y, 32));
 }
 
 
@@ -290,6 +344,8 @@ class Contour : public FilterCommon<IContour>
 public:
     Contour(ContourCS* v);
     void setRadius(float v) override;
+    void setThreshold(float v) override;
+    void setRegion(Rect v) override;
     void dispatch() override;
 
 public:
@@ -298,11 +354,16 @@ public:
 
     float m_radius = 1.0f;
     float m_strength = 1.0f;
+    float m_threshold = 0.5f;
+    Rect m_region{};
+    Rect m_write_region{};
     bool m_dirty = true;
 };
 
 Contour::Contour(ContourCS* v) : m_cs(v) {}
 void Contour::setRadius(float v) { mrCheckDirty(v == m_radius); m_radius = v; }
+void Contour::setThreshold(float v) { mrCheckDirty(v == m_threshold); m_threshold = v; }
+void Contour::setRegion(Rect v) { m_region = v; }
 
 void Contour::dispatch()
 {
@@ -311,17 +372,29 @@ void Contour::dispatch()
         return;
     }
 
+    auto region = GetWriteRegion(*m_dst, m_region);
+    if (region != m_write_region) {
+        m_write_region = region;
+        m_dirty = true;
+    }
+
     if (m_dirty) {
         struct
         {
             float radius;
             float strength;
-            int2 pad;
+            float threshold;
+            int pad;
+            int2 offset;
+            int2 end;
         } params{};
         params.radius = m_radius;
         params.strength = m_strength;
+        params.threshold = m_threshold;
+        params.offset = m_write_region.pos;
+        params.end = m_write_region.pos + m_write_region.size;
 
-        m_const = Buffer::createConstant(params);
+        Buffer::updateConstant(m_const, params);
         m_dirty = false;
     }
 
@@ -331,20 +404,31 @@ void Contour::dispatch()
 ContourCS::ContourCS()
 {
     m_cs.initialize(mrBytecode(g_hlsl_Contour));
+    m_cs_binary.initialize(mrBytecode(g_hlsl_Contour_Binary));
 }
 
 void ContourCS::dispatch(ICSContext& ctx)
 {
     auto& c = static_cast<Contour&>(ctx);
 
-    m_cs.setSRV(c.m_src);
-    m_cs.setUAV(c.m_dst);
-    m_cs.setCBuffer(c.m_const);
+    bool binary = c.m_dst->getFormat() == TextureFormat::Binary;
+    auto& cs = binary ? m_cs_binary : m_cs;
+    cs.setSRV(c.m_src);
+    cs.setUAV(c.m_dst);
+    cs.setCBuffer(c.m_const);
 
-    auto size = c.m_dst->getInternalSize();
-    m_cs.dispatch(
-        ceildiv(size.x, 32),
-        ceildiv(size.y, 32));
+    auto& region = c.m_write_region;
+    if (binary) {
+        // one thread per 32 pixels, same as Binarize
+        cs.dispatch(
+            GetWordCount(*c.m_dst, region),
+            ceildiv(region.size.y, 32));
+    }
+    else {
+        cs.dispatch(
+            ceildiv(region.size.x, 32),
+            ceildiv(region.size.y, 32));
+    }
 }
 
 IContourPtr ContourCS::createContext()
@@ -365,6 +449,7 @@ public:
     BufferPtr m_const;
 
     float m_radius = 1.0f;
+    int m_width{};
     bool m_dirty = true;
 };
 
@@ -378,15 +463,24 @@ void Expand::dispatch()
         return;
     }
 
+    // Expand_Binary needs actual width to keep row padding zero
+    int width = m_src->getSize().x;
+    if (width != m_width) {
+        m_width = width;
+        m_dirty = true;
+    }
+
     if (m_dirty) {
         struct
         {
             float radius;
-            int3 pad;
+            int width;
+            int2 pad;
         } params{};
         params.radius = m_radius;
+        params.width = m_width;
 
-        m_const = Buffer::createConstant(params);
+        Buffer::updateConstant(m_const, params);
         m_dirty = false;
     }
 
@@ -434,6 +528,7 @@ using super = FilterCommon<ITemplateMatch>;
 public:
     TemplateMatch(TemplateMatchCS* v);
     void setSrc(ITexture2DPtr v) override;
+    void setDst(ITexture2DPtr v) override;
     void setTemplate(ITexture2DPtr v) override;
     void setMask(ITexture2DPtr v) override;
     void setRegion(Rect v) override;
@@ -450,6 +545,7 @@ public:
     int2 m_src_size{};
     int2 m_template_size{};
     Rect m_region{};
+    bool m_mean = false;
     bool m_dirty = true;
 };
 
@@ -463,6 +559,15 @@ void TemplateMatch::setSrc(ITexture2DPtr v)
     m_src_size = s;
 }
 
+void TemplateMatch::setDst(ITexture2DPtr v)
+{
+    super::setDst(v);
+    // sum of differences easily exceeds half's range. Rf16 dst stores mean instead.
+    bool mean = v && v->getFormat() == TextureFormat::Rf16;
+    mrCheckDirty(m_mean == mean);
+    m_mean = mean;
+}
+
 void TemplateMatch::setTemplate(ITexture2DPtr v)
 {
     m_template = cast(v);
@@ -505,14 +610,17 @@ void TemplateMatch::dispatch()
             int2 tl;
             int2 br;
             int2 template_size;
+            float result_scale;
+            int3 pad;
         } params{};
 
         params.range = getSize();
         params.tl = m_region.pos;
         params.br = params.tl + params.range;
         params.template_size = m_template_size;
+        params.result_scale = m_mean ? 1.0f / float(m_template_size.x * m_template_size.y) : 1.0f;
 
-        m_const = Buffer::createConstant(params);
+        Buffer::updateConstant(m_const, params);
         m_dirty = false;
     }
 
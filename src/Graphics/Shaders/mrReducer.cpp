@@ -34,7 +34,7 @@ public:
     IBufferPtr getDst() const override;
 
     BufferPtr getParamsBuffer();
-    BufferPtr createParamsBuffer();
+    void updateParamsBuffer();
 
 public:
     Texture2DPtr m_src;
@@ -75,13 +75,13 @@ template<class T> IBufferPtr ReduceCommon<T>::getDst() const
 template<class T> BufferPtr ReduceCommon<T>::getParamsBuffer()
 {
     if (m_src && m_dirty) {
-        m_buf_params = createParamsBuffer();
+        updateParamsBuffer();
         m_dirty = false;
     }
     return m_buf_params;
 }
 
-template<class T> BufferPtr ReduceCommon<T>::createParamsBuffer()
+template<class T> void ReduceCommon<T>::updateParamsBuffer()
 {
     struct {
         int2 range;
@@ -93,7 +93,7 @@ template<class T> BufferPtr ReduceCommon<T>::createParamsBuffer()
     params.tl = m_region.pos;
     params.br = params.tl + params.range;
 
-    return Buffer::createConstant(params);
+    Buffer::updateConstant(m_buf_params, params);
 }
 
 
@@ -24,6 +24,8 @@ public:
 
 private:
     com_ptr<IDXGIOutputDuplication> m_duplication;
+    // duplication is driven by the consumer, so the frame is kept here rather than in the mailbox.
+    FrameInfo m_frame_info;
 };
 
 
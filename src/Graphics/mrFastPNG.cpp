@@ -0,0 +1,28 @@
+#include "pch.h"
+#include "mrGfxFoundation.h"
+
+// a private copy of stb_image_write. its settings are separate from the one in mrGfxFoundation.cpp,
+// so they don't change the output of SaveAsPNG() and Texture2D::save().
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+namespace mr {
+
+// images written by ImageWriter are mostly debug dumps. favor speed over file size.
+// (default is level 8 and trying all 5 filters for each row)
+static struct FastPNGSettings
+{
+    FastPNGSettings()
+    {
+        stbi_write_png_compression_level = 1;
+        stbi_write_force_png_filter = 1; // sub
+    }
+} g_fast_png_settings;
+
+bool WritePNGFast(const char* path, int w, int h, int channels, const void* data, int pitch)
+{
+    return stbi_write_png(path, w, h, channels, data, pitch) != 0;
+}
+
+} // namespace mr
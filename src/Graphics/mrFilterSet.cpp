@@ -11,11 +11,11 @@ public:
 
     void copy(ITexture2DPtr dst, ITexture2DPtr src, Rect src_region) override;
     void transform(ITexture2DPtr dst, ITexture2DPtr src, bool grayscale, bool filtering, Rect src_region) override;
-    void grayscale(ITexture2DPtr dst, ITexture2DPtr src, float2 range) override;
+    void grayscale(ITexture2DPtr dst, ITexture2DPtr src, float2 range, Rect src_region, Rect dst_region) override;
 
     void normalize(ITexture2DPtr dst, ITexture2DPtr src, float denom) override;
-    void binarize(ITexture2DPtr dst, ITexture2DPtr src, float threshold) override;
-    void contour(ITexture2DPtr dst, ITexture2DPtr src, float radius) override;
+    void binarize(ITexture2DPtr dst, ITexture2DPtr src, float threshold, Rect dst_region) override;
+    void contour(ITexture2DPtr dst, ITexture2DPtr src, float radius, Rect dst_region) override;
     void expand(ITexture2DPtr dst, ITexture2DPtr src, float radius) override;
     void match(ITexture2DPtr dst, ITexture2DPtr src, ITexture2DPtr tmp, ITexture2DPtr mask, Rect region) override;
 
@@ -23,6 +23,49 @@ public:
     std::future<IReduceCountBits::Result> countBits(ITexture2DPtr src, Rect region) override;
     std::future<IReduceMinMax::Result> minmax(ITexture2DPtr src, Rect region) override;
 
+    void beginGraph() override;
+    void endGraph() override;
+
+public:
+    enum class Op
+    {
+        Copy,
+        Transform,
+        Grayscale,
+        Normalize,
+        Binarize,
+        Contour,
+        Expand,
+        Match,
+    };
+
+    struct Node
+    {
+        Op op{};
+        ITexture2DPtr dst;
+        ITexture2DPtr src;
+        ITexture2DPtr tmp;
+        ITexture2DPtr mask;
+        Rect region{};
+        Rect dst_region{}; // Grayscale, Binarize and Contour: write only this region of dst
+        float2 range{};
+        float value{}; // denom, threshold or radius
+        float threshold{}; // Contour: binarize in the same pass if dst is Binary
+        bool grayscale{};
+        bool filtering{};
+
+        bool dead{};
+
+        bool reads(ITexture2D* t) const { return t && (src.get() == t || tmp.get() == t || mask.get() == t); }
+        bool partialWrite() const { return op == Op::Match || dst_region.size != int2::zero(); } // only region of dst is written
+    };
+
+    void addNode(Node&& n);
+    void execNode(Node& n);
+    void fuseNodes();
+    void eliminateDeadNodes();
+    void flushGraph();
+
 public:
     IGfxInterfacePtr m_gfx;
 
@@ -38,6 +81,9 @@ public:
     IReduceTotalPtr m_total;
     IReduceCountBitsPtr m_count_bits;
     IReduceMinMaxPtr m_minmax;
+
+    bool m_recording = false;
+    std::vector<Node> m_nodes;
 };
 mrDeclPtr(FilterSet);
 
@@ -58,86 +104,275 @@ FilterSet::FilterSet()
 
 void FilterSet::copy(ITexture2DPtr dst, ITexture2DPtr src, Rect src_region)
 {
-    mrMakeFilter(m_copy, Transform);
-    filter->setDst(dst);
-    filter->setSrc(src);
-    filter->setSrcRegion(src_region);
-    filter->dispatch();
+    addNode({ .op = Op::Copy, .dst = dst, .src = src, .region = src_region });
 }
 
 void FilterSet::transform(ITexture2DPtr dst, ITexture2DPtr src, bool grayscale, bool filtering, Rect src_region)
 {
-    mrMakeFilter(m_transform, Transform);
-    filter->setDst(dst);
-    filter->setSrc(src);
-    filter->setSrcRegion(src_region);
-    filter->setGrayscale(grayscale);
-    filter->setFiltering(filtering);
-    filter->dispatch();
+    addNode({ .op = Op::Transform, .dst = dst, .src = src, .region = src_region, .grayscale = grayscale, .filtering = filtering });
 }
 
-void FilterSet::grayscale(ITexture2DPtr dst, ITexture2DPtr src, float2 range)
+void FilterSet::grayscale(ITexture2DPtr dst, ITexture2DPtr src, float2 range, Rect src_region, Rect dst_region)
 {
-    mrMakeFilter(m_grayscale, Transform);
-    filter->setDst(dst);
-    filter->setSrc(src);
-    filter->setColorRange(range);
-    filter->setGrayscale(true);
-    if (src && dst)
-        filter->setFiltering(dst->getSize().x < src->getSize().x);
-    filter->dispatch();
+    addNode({ .op = Op::Grayscale, .dst = dst, .src = src, .region = src_region, .dst_region = dst_region, .range = range });
 }
 
 void FilterSet::normalize(ITexture2DPtr dst, ITexture2DPtr src, float denom)
 {
-    mrMakeFilter(m_normalize, Normalize);
-    filter->setDst(dst);
-    filter->setSrc(src);
-    filter->setMax(denom);
-    filter->dispatch();
+    addNode({ .op = Op::Normalize, .dst = dst, .src = src, .value = denom });
 }
 
-void FilterSet::binarize(ITexture2DPtr dst, ITexture2DPtr src, float threshold)
+void FilterSet::binarize(ITexture2DPtr dst, ITexture2DPtr src, float threshold, Rect dst_region)
 {
-    mrMakeFilter(m_binarize, Binarize);
-    filter->setDst(dst);
-    filter->setSrc(src);
-    filter->setThreshold(threshold);
-    filter->dispatch();
+    addNode({ .op = Op::Binarize, .dst = dst, .src = src, .dst_region = dst_region, .value = threshold });
 }
 
-void FilterSet::contour(ITexture2DPtr dst, ITexture2DPtr src, float radius)
+void FilterSet::contour(ITexture2DPtr dst, ITexture2DPtr src, float radius, Rect dst_region)
 {
-    mrMakeFilter(m_contour, Contour);
-    filter->setDst(dst);
-    filter->setSrc(src);
-    filter->setRadius(radius);
-    filter->dispatch();
+    addNode({ .op = Op::Contour, .dst = dst, .src = src, .dst_region = dst_region, .value = radius });
 }
 
 void FilterSet::expand(ITexture2DPtr dst, ITexture2DPtr src, float radius)
 {
-    mrMakeFilter(m_expand, Expand);
-    filter->setDst(dst);
-    filter->setSrc(src);
-    filter->setRadius(radius);
-    filter->dispatch();
+    addNode({ .op = Op::Expand, .dst = dst, .src = src, .value = radius });
 }
 
 void FilterSet::match(ITexture2DPtr dst, ITexture2DPtr src, ITexture2DPtr tmp, ITexture2DPtr mask, Rect region)
 {
-    mrMakeFilter(m_match, TemplateMatch);
-    filter->setDst(dst);
-    filter->setSrc(src);
-    filter->setTemplate(tmp);
-    filter->setMask(mask);
-    filter->setRegion(region);
-    filter->dispatch();
+    addNode({ .op = Op::Match, .dst = dst, .src = src, .tmp = tmp, .mask = mask, .region = region });
+}
+
+void FilterSet::addNode(Node&& n)
+{
+    if (m_recording)
+        m_nodes.push_back(std::move(n));
+    else
+        execNode(n);
+}
+
+void FilterSet::execNode(Node& n)
+{
+    switch (n.op) {
+    case Op::Copy:
+    {
+        mrMakeFilter(m_copy, Transform);
+        filter->setDst(n.dst);
+        filter->setSrc(n.src);
+        filter->setSrcRegion(n.region);
+        filter->dispatch();
+        break;
+    }
+    case Op::Transform:
+    {
+        mrMakeFilter(m_transform, Transform);
+        filter->setDst(n.dst);
+        filter->setSrc(n.src);
+        filter->setSrcRegion(n.region);
+        filter->setGrayscale(n.grayscale);
+        filter->setFiltering(n.filtering);
+        filter->dispatch();
+        break;
+    }
+    case Op::Grayscale:
+    {
+        mrMakeFilter(m_grayscale, Transform);
+        filter->setDst(n.dst);
+        filter->setSrc(n.src);
+        filter->setSrcRegion(n.region);
+        filter->setDstRegion(n.dst_region);
+        filter->setColorRange(n.range);
+        filter->setGrayscale(true);
+        if (n.src && n.dst) {
+            int src_width = n.region.size.x != 0 ? n.region.size.x : n.src->getSize().x;
+            filter->setFiltering(n.dst->getSize().x < src_width);
+        }
+        filter->dispatch();
+        break;
+    }
+    case Op::Normalize:
+    {
+        mrMakeFilter(m_normalize, Normalize);
+        filter->setDst(n.dst);
+        filter->setSrc(n.src);
+        filter->setMax(n.value);
+        filter->dispatch();
+        break;
+    }
+    case Op::Binarize:
+    {
+        mrMakeFilter(m_binarize, Binarize);
+        filter->setDst(n.dst);
+        filter->setSrc(n.src);
+        filter->setThreshold(n.value);
+        filter->setRegion(n.dst_region);
+        filter->dispatch();
+        break;
+    }
+    case Op::Contour:
+    {
+        mrMakeFilter(m_contour, Contour);
+        filter->setDst(n.dst);
+        filter->setSrc(n.src);
+        filter->setRadius(n.value);
+        filter->setThreshold(n.threshold);
+        filter->setRegion(n.dst_region);
+        filter->dispatch();
+        break;
+    }
+    case Op::Expand:
+    {
+        mrMakeFilter(m_expand, Expand);
+        filter->setDst(n.dst);
+        filter->setSrc(n.src);
+        filter->setRadius(n.value);
+        filter->dispatch();
+        break;
+    }
+    case Op::Match:
+    {
+        mrMakeFilter(m_match, TemplateMatch);
+        filter->setDst(n.dst);
+        filter->setSrc(n.src);
+        filter->setTemplate(n.tmp);
+        filter->setMask(n.mask);
+        filter->setRegion(n.region);
+        filter->dispatch();
+        break;
+    }
+    }
+}
+
+
+void FilterSet::beginGraph()
+{
+    m_recording = true;
+}
+
+void FilterSet::endGraph()
+{
+    flushGraph();
+    m_recording = false;
+}
+
+// empty region is entire image
+static bool IsWordAligned(Rect region, int width)
+{
+    int end = region.pos.x + region.size.x;
+    return region.size == int2::zero() || (region.pos.x % 32 == 0 && (end % 32 == 0 || end >= width));
+}
+
+// contour(C, G) -> binarize(B, C) to contour(B, G) with threshold, if nobody else reads C.
+// the fused contour quantizes to 8 bits before the threshold, so C must be Ru8 to give the same result.
+void FilterSet::fuseNodes()
+{
+    int n = (int)m_nodes.size();
+    for (int i = 0; i < n; ++i) {
+        auto& c = m_nodes[i];
+        if (c.dead || c.op != Op::Contour || !c.dst || c.dst->getFormat() != TextureFormat::Ru8)
+            continue;
+
+        // references other than the graph's mean someone may read C after the graph
+        auto tex = c.dst.get();
+        int graph_refs = 0;
+        for (auto& o : m_nodes)
+            graph_refs += (o.dst.get() == tex) + (o.src.get() == tex) + (o.tmp.get() == tex) + (o.mask.get() == tex);
+        if (tex->getRef() > graph_refs)
+            continue;
+
+        // the next node touching C must be the binarize, and it must be the only reader of C
+        int j = i + 1;
+        bool src_written = false;
+        for (; j < n; ++j) {
+            auto& o = m_nodes[j];
+            if (o.dead)
+                continue;
+            if (o.reads(tex) || o.dst.get() == tex)
+                break;
+            if (o.dst.get() == c.src.get())
+                src_written = true;
+        }
+        if (j == n || src_written)
+            continue;
+        auto& b = m_nodes[j];
+        if (b.op != Op::Binarize || b.src.get() != tex || !b.dst || b.dst->getFormat() != TextureFormat::Binary)
+            continue;
+        // the fused contour reads src inside the binarize's region, which is extended to 32 pixel boundaries.
+        // the result is same only if the regions are same and already aligned.
+        if (b.dst_region != c.dst_region || !IsWordAligned(b.dst_region, b.dst->getSize().x))
+            continue;
+        bool other_readers = false;
+        for (int k = j + 1; k < n && !other_readers; ++k) {
+            if (m_nodes[k].dst.get() == tex)
+                break;
+            other_readers = m_nodes[k].reads(tex);
+        }
+        if (other_readers)
+            continue;
+
+        // execute the fused one at the place of the binarize
+        b.op = Op::Contour;
+        b.src = c.src;
+        b.threshold = b.value;
+        b.value = c.value;
+        c.dead = true;
+    }
+}
+
+// skip nodes whose output is overwritten or never read, unless someone outside the graph holds the output.
+void FilterSet::eliminateDeadNodes()
+{
+    std::map<ITexture2D*, int> graph_refs;
+    for (auto& n : m_nodes) {
+        for (auto* t : { n.dst.get(), n.src.get(), n.tmp.get(), n.mask.get() }) {
+            if (t)
+                graph_refs[t]++;
+        }
+    }
+
+    // textures whose current content is needed at the point. walk the graph backward.
+    std::set<ITexture2D*> live;
+    for (auto& kvp : graph_refs) {
+        if (kvp.first->getRef() > kvp.second)
+            live.insert(kvp.first);
+    }
+    for (auto& n : m_nodes | std::views::reverse) {
+        if (n.dead)
+            continue;
+        auto dst = n.dst.get();
+        if (!live.contains(dst)) {
+            n.dead = true;
+            continue;
+        }
+        if (!n.partialWrite())
+            live.erase(dst);
+        for (auto* t : { n.src.get(), n.tmp.get(), n.mask.get() }) {
+            if (t)
+                live.insert(t);
+        }
+    }
+}
+
+void FilterSet::flushGraph()
+{
+    if (m_nodes.empty())
+        return;
+
+    fuseNodes();
+    eliminateDeadNodes();
+
+    // all nodes go to the same immediate context, so they are issued in recorded order
+    for (auto& n : m_nodes) {
+        if (!n.dead)
+            execNode(n);
+    }
+    m_nodes.clear();
+    m_gfx->flush();
 }
 
 
 std::future<IReduceTotal::Result> FilterSet::total(ITexture2DPtr src, Rect region)
 {
+    flushGraph();
     mrMakeFilter(m_total, ReduceTotal);
     filter->setSrc(src);
     filter->setRegion(region);
@@ -148,6 +383,7 @@ std::future<IReduceTotal::Result> FilterSet::total(ITexture2DPtr src, Rect regio
 
 std::future<IReduceCountBits::Result> FilterSet::countBits(ITexture2DPtr src, Rect region)
 {
+    flushGraph();
     mrMakeFilter(m_count_bits, ReduceCountBits);
     filter->setSrc(src);
     filter->setRegion(region);
@@ -158,6 +394,7 @@ std::future<IReduceCountBits::Result> FilterSet::countBits(ITexture2DPtr src, Re
 
 std::future<IReduceMinMax::Result> FilterSet::minmax(ITexture2DPtr src, Rect region)
 {
+    flushGraph();
     mrMakeFilter(m_minmax, ReduceMinMax);
     filter->setSrc(src);
     filter->setRegion(region);
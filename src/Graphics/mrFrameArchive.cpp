@@ -0,0 +1,542 @@
+#include "pch.h"
+#include "mrInternal.h"
+
+namespace mr {
+
+// archive layout:
+//   Header
+//   frame data (one block per frame)
+//   FrameIndex[frame_count] (at header.index_offset)
+//
+// each frame block is uint32_t tile_sizes[tile_count] followed by tile data.
+// the image is split into tiles and each tile is coded independently:
+//  - keyframe: each pixel is XORed with its left neighbor in the tile.
+//  - delta frame: each pixel is XORed with the same pixel of the previous frame. unchanged tiles have size 0.
+// predicted words are then run-length coded: uint32_t token = (zero_run << 16) | literal_count, followed by literal words.
+// screens are mostly flat colors and mostly static, so both predictions produce long zero runs.
+
+static const char g_archive_magic[4] = { 'M', 'R', 'F', 'A' };
+static const uint32_t g_archive_version = 1;
+
+struct ArchiveHeader
+{
+    char magic[4]{};
+    uint32_t version{};
+    int32_t width{};
+    int32_t height{};
+    uint32_t format{};
+    uint32_t tile_size{};
+    uint32_t keyframe_interval{};
+    uint32_t frame_count{};
+    uint64_t index_offset{};
+    uint64_t pad[3]{};
+};
+static_assert(sizeof(ArchiveHeader) == 64);
+
+struct ArchiveFrameIndex
+{
+    uint64_t time{};
+    uint64_t offset{};
+    uint32_t size{};
+    uint32_t keyframe{};
+};
+
+struct ArchiveLayout
+{
+    int2 size{};
+    int tile_size{};
+    int2 tiles{};
+
+    ArchiveLayout(int2 s, int ts) : size(s), tile_size(ts), tiles{ ceildiv(s.x, ts), ceildiv(s.y, ts) } {}
+    int getTileCount() const { return tiles.x * tiles.y; }
+    Rect getTileRect(int i) const
+    {
+        int2 pos{ (i % tiles.x) * tile_size, (i / tiles.x) * tile_size };
+        int2 size_{ std::min(tile_size, size.x - pos.x), std::min(tile_size, size.y - pos.y) };
+        return { pos, size_ };
+    }
+};
+
+
+class FrameArchiveWriter : public RefCount<IFrameArchiveWriter>
+{
+public:
+    FrameArchiveWriter(const char* path, int width, int height, TextureFormat format);
+    ~FrameArchiveWriter() override;
+    bool valid() const;
+
+    bool addFrame(const void* data, int pitch, uint64_t time) override;
+    bool addFrame(ITexture2DPtr surface, uint64_t time) override;
+    bool close() override;
+    int getFrameCount() const override;
+    int getDroppedFrameCount() const override;
+
+private:
+    struct QueuedFrame
+    {
+        uint64_t time{};
+        std::vector<uint32_t> pixels;
+    };
+
+    void compressThread();
+    void encodeFrame(const QueuedFrame& frame);
+
+    static const size_t MaxQueuedFrames = 8;
+
+    std::ofstream m_ofs;
+    ArchiveHeader m_header{};
+    ArchiveLayout m_layout;
+    std::vector<ArchiveFrameIndex> m_index;
+    std::vector<uint32_t> m_prev;
+    std::vector<uint32_t> m_encoded;
+    std::vector<uint32_t> m_tile;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<QueuedFrame> m_queue;
+    std::vector<std::vector<uint32_t>> m_free_buffers;
+    std::thread m_thread;
+    bool m_closing = false;
+    std::atomic_int m_frame_count{ 0 };
+    std::atomic_int m_dropped{ 0 };
+};
+
+
+static void EncodeWords(std::vector<uint32_t>& dst, const uint32_t* src, size_t n)
+{
+    size_t i = 0;
+    while (i < n) {
+        uint32_t zeros = 0;
+        while (i < n && src[i] == 0 && zeros < 0xffff) {
+            ++zeros;
+            ++i;
+        }
+        size_t lit_begin = i;
+        uint32_t literals = 0;
+        while (i < n && src[i] != 0 && literals < 0xffff) {
+            ++literals;
+            ++i;
+        }
+        dst.push_back((zeros << 16) | literals);
+        dst.insert(dst.end(), src + lit_begin, src + lit_begin + literals);
+    }
+}
+
+// returns number of words consumed from src, or 0 if the stream is broken
+static size_t DecodeWords(uint32_t* dst, size_t n, const uint32_t* src, size_t src_size)
+{
+    size_t di = 0, si = 0;
+    while (di < n) {
+        if (si >= src_size)
+            return 0;
+        uint32_t token = src[si++];
+        uint32_t zeros = token >> 16;
+        uint32_t literals = token & 0xffff;
+        if (di + zeros + literals > n || si + literals > src_size)
+            return 0;
+        std::fill_n(dst + di, zeros, 0u);
+        di += zeros;
+        std::copy_n(src + si, literals, dst + di);
+        di += literals;
+        si += literals;
+    }
+    return si;
+}
+
+
+FrameArchiveWriter::FrameArchiveWriter(const char* path, int width, int height, TextureFormat format)
+    : m_layout({ width, height }, 64)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    m_ofs.open(path, std::ios::out | std::ios::binary);
+    if (!m_ofs)
+        return;
+
+    std::copy_n(g_archive_magic, 4, m_header.magic);
+    m_header.version = g_archive_version;
+    m_header.width = width;
+    m_header.height = height;
+    m_header.format = (uint32_t)format;
+    m_header.tile_size = m_layout.tile_size;
+    m_header.keyframe_interval = 30;
+    // placeholder. rewritten by close()
+    m_ofs.write((const char*)&m_header, sizeof(m_header));
+
+    m_thread = std::thread([this]() { compressThread(); });
+}
+
+FrameArchiveWriter::~FrameArchiveWriter()
+{
+    close();
+}
+
+bool FrameArchiveWriter::valid() const
+{
+    return m_thread.joinable();
+}
+
+bool FrameArchiveWriter::addFrame(const void* data, int pitch, uint64_t time)
+{
+    if (!data || !m_thread.joinable())
+        return false;
+
+    int2 size = m_layout.size;
+    if (pitch == 0)
+        pitch = size.x * 4;
+
+    std::vector<uint32_t> pixels;
+    {
+        std::unique_lock l(m_mutex);
+        if (m_closing)
+            return false;
+        if (m_queue.size() >= MaxQueuedFrames) {
+            // never block the caller. drop the frame instead.
+            ++m_dropped;
+            return false;
+        }
+        if (!m_free_buffers.empty()) {
+            pixels = std::move(m_free_buffers.back());
+            m_free_buffers.pop_back();
+        }
+    }
+
+    pixels.resize(size.x * size.y);
+    for (int y = 0; y < size.y; ++y)
+        memcpy(&pixels[size.x * y], (const byte*)data + (pitch * y), size.x * 4);
+
+    {
+        std::unique_lock l(m_mutex);
+        m_queue.push_back({ time, std::move(pixels) });
+    }
+    m_cond.notify_one();
+    return true;
+}
+
+bool FrameArchiveWriter::addFrame(ITexture2DPtr surface, uint64_t time)
+{
+    if (!surface || surface->getSize().x < m_layout.size.x || surface->getSize().y < m_layout.size.y) {
+        ++m_dropped;
+        return false;
+    }
+
+    MappedTexture mapped(surface);
+    if (!mapped)
+        return false;
+    return addFrame(mapped.data(), mapped.getPitch(), time);
+}
+
+void FrameArchiveWriter::compressThread()
+{
+    for (;;) {
+        QueuedFrame frame;
+        {
+            std::unique_lock l(m_mutex);
+            m_cond.wait(l, [this]() { return !m_queue.empty() || m_closing; });
+            if (m_queue.empty())
+                break;
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        encodeFrame(frame);
+
+        {
+            std::unique_lock l(m_mutex);
+            m_free_buffers.push_back(std::move(m_prev));
+        }
+        m_prev = std::move(frame.pixels);
+    }
+}
+
+void FrameArchiveWriter::encodeFrame(const QueuedFrame& frame)
+{
+    int tile_count = m_layout.getTileCount();
+    int width = m_layout.size.x;
+    bool keyframe = m_prev.empty() || (m_index.size() % m_header.keyframe_interval) == 0;
+
+    m_encoded.clear();
+    m_encoded.resize(tile_count);
+    for (int ti = 0; ti < tile_count; ++ti) {
+        Rect r = m_layout.getTileRect(ti);
+
+        bool changed = keyframe;
+        if (!changed) {
+            for (int y = 0; y < r.size.y && !changed; ++y) {
+                size_t o = size_t(width) * (r.pos.y + y) + r.pos.x;
+                changed = memcmp(&frame.pixels[o], &m_prev[o], r.size.x * 4) != 0;
+            }
+        }
+        if (!changed)
+            continue; // tile size 0
+
+        m_tile.resize(r.size.x * r.size.y);
+        auto* dst = m_tile.data();
+        for (int y = 0; y < r.size.y; ++y) {
+            size_t o = size_t(width) * (r.pos.y + y) + r.pos.x;
+            const uint32_t* src = &frame.pixels[o];
+            if (keyframe) {
+                uint32_t left = 0;
+                for (int x = 0; x < r.size.x; ++x) {
+                    *dst++ = src[x] ^ left;
+                    left = src[x];
+                }
+            }
+            else {
+                const uint32_t* prev = &m_prev[o];
+                for (int x = 0; x < r.size.x; ++x)
+                    *dst++ = src[x] ^ prev[x];
+            }
+        }
+
+        size_t begin = m_encoded.size();
+        EncodeWords(m_encoded, m_tile.data(), m_tile.size());
+        m_encoded[ti] = uint32_t((m_encoded.size() - begin) * 4);
+    }
+
+    ArchiveFrameIndex index{};
+    index.time = frame.time;
+    index.offset = (uint64_t)m_ofs.tellp();
+    index.size = uint32_t(m_encoded.size() * 4);
+    index.keyframe = keyframe ? 1 : 0;
+    m_ofs.write((const char*)m_encoded.data(), index.size);
+    m_index.push_back(index);
+    ++m_frame_count;
+}
+
+bool FrameArchiveWriter::close()
+{
+    if (!m_thread.joinable())
+        return false;
+
+    {
+        std::unique_lock l(m_mutex);
+        m_closing = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+
+    m_header.frame_count = (uint32_t)m_index.size();
+    m_header.index_offset = (uint64_t)m_ofs.tellp();
+    m_ofs.write((const char*)m_index.data(), m_index.size() * sizeof(ArchiveFrameIndex));
+    m_ofs.seekp(0);
+    m_ofs.write((const char*)&m_header, sizeof(m_header));
+    m_ofs.close();
+    return true;
+}
+
+int FrameArchiveWriter::getFrameCount() const
+{
+    return m_frame_count;
+}
+
+int FrameArchiveWriter::getDroppedFrameCount() const
+{
+    return m_dropped;
+}
+
+mrAPI IFrameArchiveWriter* CreateFrameArchiveWriter_(const char* path, int width, int height, TextureFormat format)
+{
+    if (!path)
+        return nullptr;
+
+    auto ret = new FrameArchiveWriter(path, width, height, format);
+    if (!ret->valid()) {
+        delete ret;
+        ret = nullptr;
+    }
+    return ret;
+}
+
+
+
+class FrameArchiveReader : public RefCount<IFrameArchiveReader>
+{
+public:
+    FrameArchiveReader(const char* path);
+    ~FrameArchiveReader() override;
+    bool valid() const;
+
+    int getFrameCount() const override;
+    int2 getSize() const override;
+    TextureFormat getFormat() const override;
+    uint64_t getTime(int i) const override;
+    int findFrame(uint64_t time) const override;
+    bool readFrame(int i, void* dst, int pitch) override;
+
+private:
+    bool applyFrame(int i);
+
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+    const byte* m_data = nullptr;
+    size_t m_data_size = 0;
+
+    const ArchiveHeader* m_header = nullptr;
+    const ArchiveFrameIndex* m_index = nullptr;
+    std::optional<ArchiveLayout> m_layout;
+
+    // last decoded frame. sequential and nearby reads only apply deltas.
+    std::vector<uint32_t> m_current;
+    std::vector<uint32_t> m_tile;
+    int m_current_index = -1;
+};
+
+FrameArchiveReader::FrameArchiveReader(const char* path)
+{
+    m_file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER size{};
+    ::GetFileSizeEx(m_file, &size);
+    if (size.QuadPart < (LONGLONG)sizeof(ArchiveHeader))
+        return;
+
+    m_mapping = ::CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+        return;
+    m_data = (const byte*)::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data)
+        return;
+    m_data_size = (size_t)size.QuadPart;
+
+    auto header = (const ArchiveHeader*)m_data;
+    if (memcmp(header->magic, g_archive_magic, 4) != 0 || header->version != g_archive_version ||
+        header->width <= 0 || header->height <= 0 || header->tile_size == 0 ||
+        header->index_offset + header->frame_count * sizeof(ArchiveFrameIndex) > m_data_size)
+    {
+        mrDbgPrint("*** FrameArchiveReader: %s is not a valid archive ***\n", path);
+        return;
+    }
+    m_header = header;
+    m_index = (const ArchiveFrameIndex*)(m_data + header->index_offset);
+    m_layout.emplace(int2{ header->width, header->height }, (int)header->tile_size);
+    m_current.resize(size_t(header->width) * header->height);
+}
+
+FrameArchiveReader::~FrameArchiveReader()
+{
+    if (m_data)
+        ::UnmapViewOfFile(m_data);
+    if (m_mapping)
+        ::CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        ::CloseHandle(m_file);
+}
+
+bool FrameArchiveReader::valid() const
+{
+    return m_header != nullptr;
+}
+
+int FrameArchiveReader::getFrameCount() const { return m_header->frame_count; }
+int2 FrameArchiveReader::getSize() const { return m_layout->size; }
+TextureFormat FrameArchiveReader::getFormat() const { return (TextureFormat)m_header->format; }
+
+uint64_t FrameArchiveReader::getTime(int i) const
+{
+    if (i < 0 || i >= getFrameCount())
+        return 0;
+    return m_index[i].time;
+}
+
+int FrameArchiveReader::findFrame(uint64_t time) const
+{
+    auto begin = m_index;
+    auto end = m_index + m_header->frame_count;
+    auto it = std::upper_bound(begin, end, time,
+        [](uint64_t t, const ArchiveFrameIndex& v) { return t < v.time; });
+    return int(std::distance(begin, it)) - 1;
+}
+
+bool FrameArchiveReader::applyFrame(int i)
+{
+    auto& index = m_index[i];
+    if (index.offset + index.size > m_data_size)
+        return false;
+
+    int tile_count = m_layout->getTileCount();
+    int width = m_layout->size.x;
+    auto* words = (const uint32_t*)(m_data + index.offset);
+    size_t word_count = index.size / 4;
+    if (word_count < (size_t)tile_count)
+        return false;
+
+    auto* tile_sizes = words;
+    size_t pos = tile_count;
+    for (int ti = 0; ti < tile_count; ++ti) {
+        size_t tile_words = tile_sizes[ti] / 4;
+        if (tile_words == 0)
+            continue;
+        if (pos + tile_words > word_count)
+            return false;
+
+        Rect r = m_layout->getTileRect(ti);
+        m_tile.resize(r.size.x * r.size.y);
+        if (DecodeWords(m_tile.data(), m_tile.size(), words + pos, tile_words) == 0)
+            return false;
+        pos += tile_words;
+
+        auto* src = m_tile.data();
+        for (int y = 0; y < r.size.y; ++y) {
+            uint32_t* dst = &m_current[size_t(width) * (r.pos.y + y) + r.pos.x];
+            if (index.keyframe) {
+                uint32_t left = 0;
+                for (int x = 0; x < r.size.x; ++x)
+                    left = dst[x] = *src++ ^ left;
+            }
+            else {
+                for (int x = 0; x < r.size.x; ++x)
+                    dst[x] ^= *src++;
+            }
+        }
+    }
+    m_current_index = i;
+    return true;
+}
+
+bool FrameArchiveReader::readFrame(int i, void* dst, int pitch)
+{
+    if (i < 0 || i >= getFrameCount() || !dst)
+        return false;
+
+    if (i != m_current_index) {
+        // find the keyframe this frame depends on
+        int key = i;
+        while (key > 0 && !m_index[key].keyframe)
+            --key;
+
+        // continue from the current frame if it is between the keyframe and the target
+        int first = (m_current_index >= key && m_current_index < i) ? m_current_index + 1 : key;
+        for (int fi = first; fi <= i; ++fi) {
+            if (!applyFrame(fi)) {
+                m_current_index = -1;
+                return false;
+            }
+        }
+    }
+
+    int2 size = m_layout->size;
+    if (pitch == 0)
+        pitch = size.x * 4;
+    for (int y = 0; y < size.y; ++y)
+        memcpy((byte*)dst + (pitch * y), &m_current[size_t(size.x) * y], size.x * 4);
+    return true;
+}
+
+mrAPI IFrameArchiveReader* OpenFrameArchive_(const char* path)
+{
+    if (!path)
+        return nullptr;
+
+    auto ret = new FrameArchiveReader(path);
+    if (!ret->valid()) {
+        delete ret;
+        ret = nullptr;
+    }
+    return ret;
+}
+
+} // namespace mr
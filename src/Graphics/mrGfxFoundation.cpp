@@ -6,11 +6,31 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image.h>
 #include <stb_image_write.h>
+#include <emmintrin.h>
 
 #pragma comment(lib, "d3d11.lib")
 
 namespace mr {
 
+// BGRA <-> RGBA. SSE2 is always available on x64.
+static void SwapRB(uint32_t* dst, const uint32_t* src, size_t n)
+{
+    size_t i = 0;
+    const __m128i mask_ga = _mm_set1_epi32(0xff00ff00);
+    const __m128i mask_b = _mm_set1_epi32(0x000000ff);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i ga = _mm_and_si128(v, mask_ga);
+        __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), mask_b);
+        __m128i b = _mm_slli_epi32(_mm_and_si128(v, mask_b), 16);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(ga, _mm_or_si128(r, b)));
+    }
+    for (; i < n; ++i) {
+        uint32_t v = src[i];
+        dst[i] = (v & 0xff00ff00) | ((v >> 16) & 0xff) | ((v & 0xff) << 16);
+    }
+}
+
 FenceEvent::FenceEvent()
 {
     m_handle = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
@@ -38,6 +58,210 @@ FenceEvent::operator HANDLE() const
 }
 
 
+// keep pooled resources up to this size in total. oldest ones are freed first.
+static const size_t kMaxPooledBytes = 256 * 1024 * 1024;
+
+static size_t GetPooledBytes(const ResourcePool::TextureEntry& e)
+{
+    size_t ret = size_t(GetRowSize(e.format, e.size.x)) * e.size.y;
+    return e.staging ? ret * 2 : ret;
+}
+
+static size_t GetPooledBytes(const ResourcePool::BufferEntry& e)
+{
+    size_t ret = e.size;
+    return e.staging ? ret * 2 : ret;
+}
+
+template<class Entry, class Match>
+bool ResourcePool::acquireImpl(std::deque<Entry>& entries, Entry& dst, const Match& match)
+{
+    auto g = mrGfxGlobals();
+    std::unique_lock l(m_mutex);
+
+    uint64_t completed = g->getCompletedFenceValue();
+    for (auto i = entries.begin(); i != entries.end(); ++i) {
+        if (match(*i) && i->fence <= completed) {
+            m_pooled_bytes -= GetPooledBytes(*i);
+            dst = std::move(*i);
+            entries.erase(i);
+            ++m_reused;
+            return true;
+        }
+    }
+    ++m_created;
+    return false;
+}
+
+template<class Entry>
+void ResourcePool::releaseImpl(std::deque<Entry>& entries, Entry&& v)
+{
+    auto g = GfxGlobals::find();
+    if (!g)
+        return;
+
+    std::unique_lock l(m_mutex);
+    v.fence = g->getFenceValue() + 1;
+    m_pooled_bytes += GetPooledBytes(v);
+    entries.push_back(std::move(v));
+    trim();
+    m_fence_requested = true;
+}
+
+// called with m_mutex locked
+void ResourcePool::trim()
+{
+    // textures take most of the space. buffers are freed only if textures alone are not enough.
+    while (m_pooled_bytes > kMaxPooledBytes && !m_textures.empty()) {
+        m_pooled_bytes -= GetPooledBytes(m_textures.front());
+        m_textures.pop_front();
+    }
+    while (m_pooled_bytes > kMaxPooledBytes && !m_buffers.empty()) {
+        m_pooled_bytes -= GetPooledBytes(m_buffers.front());
+        m_buffers.pop_front();
+    }
+}
+
+bool ResourcePool::acquire(TextureEntry& dst)
+{
+    return acquireImpl(m_textures, dst, [&](const TextureEntry& e) {
+        return e.size == dst.size && e.format == dst.format;
+        });
+}
+
+bool ResourcePool::acquire(BufferEntry& dst)
+{
+    return acquireImpl(m_buffers, dst, [&](const BufferEntry& e) {
+        return e.size == dst.size && e.stride == dst.stride;
+        });
+}
+
+void ResourcePool::release(TextureEntry&& v) { releaseImpl(m_textures, std::move(v)); }
+void ResourcePool::release(BufferEntry&& v) { releaseImpl(m_buffers, std::move(v)); }
+
+bool ResourcePool::popFenceRequest()
+{
+    return m_fence_requested.exchange(false);
+}
+
+ResourcePoolStats ResourcePool::getStats()
+{
+    std::unique_lock l(m_mutex);
+    return { m_reused, m_created, m_pooled_bytes, kMaxPooledBytes };
+}
+
+void ResourcePool::clear()
+{
+    std::unique_lock l(m_mutex);
+    m_textures.clear();
+    m_buffers.clear();
+    m_pooled_bytes = 0;
+}
+
+
+static const size_t kMaxQueuedImages = 16;
+static const int kImageWriterThreads = 2;
+
+ImageWriter::ImageWriter()
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+    {
+        std::unique_lock l(m_mutex);
+        m_closing = true;
+    }
+    m_cond.notify_all();
+    for (auto& t : m_threads)
+        t.join();
+}
+
+void ImageWriter::startThreads()
+{
+    // called with m_mutex locked. threads are spawned on first use.
+    if (!m_threads.empty())
+        return;
+    for (int i = 0; i < kImageWriterThreads; ++i)
+        m_threads.emplace_back([this]() { workerThread(); });
+}
+
+std::future<bool> ImageWriter::write(const std::string& path, int2 size, TextureFormat format, const ReadFunc& read)
+{
+    Job job{ path, size, format };
+    auto ret = job.result.get_future();
+    {
+        // reserve a slot, so that the queue never exceeds the bound while the image is read outside the lock
+        std::unique_lock l(m_mutex);
+        if (m_closing || m_queue.size() + m_reserved >= kMaxQueuedImages) {
+            // drop before reading to avoid the cost of download
+            ++m_dropped;
+            job.result.set_value(false);
+            return ret;
+        }
+        ++m_reserved;
+    }
+
+    bool ok = read(job.data, job.pitch) && !job.data.empty();
+    {
+        std::unique_lock l(m_mutex);
+        --m_reserved;
+        if (ok) {
+            startThreads();
+            m_queue.push_back(std::move(job));
+        }
+    }
+    if (!ok) {
+        job.result.set_value(false);
+        return ret;
+    }
+    m_cond.notify_one();
+    return ret;
+}
+
+void ImageWriter::wait()
+{
+    std::unique_lock l(m_mutex);
+    m_cond_done.wait(l, [this]() { return m_queue.empty() && m_busy == 0; });
+}
+
+int ImageWriter::getDroppedCount() const
+{
+    return m_dropped;
+}
+
+void ImageWriter::workerThread()
+{
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock l(m_mutex);
+            m_cond.wait(l, [this]() { return m_closing || !m_queue.empty(); });
+            if (m_queue.empty())
+                break;
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+            ++m_busy;
+        }
+
+        job.result.set_value(Texture2D::saveImpl(job.path, job.size, job.format, job.data.data(), job.pitch, true));
+
+        {
+            std::unique_lock l(m_mutex);
+            --m_busy;
+        }
+        m_cond_done.notify_all();
+    }
+}
+
+
+GfxGlobals* GfxGlobals::s_instance;
+
+GfxGlobals* GfxGlobals::find()
+{
+    return s_instance;
+}
+
 GfxGlobals* GfxGlobals::get()
 {
     static std::unique_ptr<GfxGlobals> s_inst;
@@ -51,10 +275,14 @@ GfxGlobals* GfxGlobals::get()
 
 GfxGlobals::GfxGlobals()
 {
+    s_instance = this;
 }
 
 GfxGlobals::~GfxGlobals()
 {
+    s_instance = nullptr;
+    m_resource_pool.clear();
+
 #define Body(Name) m_cs_##Name = {};
     mrEachCS(Body)
 #undef Body
@@ -145,6 +373,16 @@ uint64_t GfxGlobals::addFenceEvent()
     return fv;
 }
 
+uint64_t GfxGlobals::getFenceValue() const
+{
+    return m_fence_value;
+}
+
+uint64_t GfxGlobals::getCompletedFenceValue()
+{
+    return m_fence ? m_fence->GetCompletedValue() : m_fence_value.load();
+}
+
 bool GfxGlobals::waitFence(uint64_t v, uint32_t timeout_ms)
 {
     if (SUCCEEDED(m_fence->SetEventOnCompletion(v, m_fence_event))) {
@@ -157,6 +395,9 @@ bool GfxGlobals::waitFence(uint64_t v, uint32_t timeout_ms)
 
 void GfxGlobals::flush()
 {
+    // make resources released since the last flush reusable once the GPU gets here
+    if (m_resource_pool.popFenceRequest())
+        addFenceEvent();
     m_context->Flush();
 }
 
@@ -177,6 +418,16 @@ ID3D11SamplerState* GfxGlobals::getLinearSampler()
     return m_sampler_linear.get();
 }
 
+ResourcePool& GfxGlobals::getResourcePool()
+{
+    return m_resource_pool;
+}
+
+ImageWriter& GfxGlobals::getImageWriter()
+{
+    return m_image_writer;
+}
+
 void GfxGlobals::lock()
 {
     m_mutex.lock();
@@ -200,8 +451,9 @@ BufferPtr Buffer::createConstant(uint32_t size, const void* data)
 
     ret->m_size = size;
     {
-        D3D11_BUFFER_DESC desc{ size, D3D11_USAGE_IMMUTABLE, 0, 0, 0, size };
+        D3D11_BUFFER_DESC desc{ size, D3D11_USAGE_DYNAMIC, 0, 0, 0, size };
         desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
 
         D3D11_SUBRESOURCE_DATA sd{ data, 0, 0 };
         mrGfxDevice()->CreateBuffer(&desc, &sd, ret->m_buffer.put());
@@ -215,6 +467,24 @@ BufferPtr Buffer::createStructured(uint32_t size, uint32_t stride, const void* d
 
     ret->m_size = size;
     ret->m_stride = stride;
+    ret->m_pooled = true;
+    if (!data) {
+        ResourcePool::BufferEntry e{ (int)size, (int)stride };
+        if (mrGfxGlobals()->getResourcePool().acquire(e)) {
+            ret->m_buffer = std::move(e.buffer);
+            ret->m_staging = std::move(e.staging);
+            ret->m_srv = std::move(e.srv);
+            ret->m_uav = std::move(e.uav);
+
+            // keep same result as newly created one. the pool is shared by threads, but the context is not.
+            if (ret->m_uav) {
+                mrGfxLockScope();
+                const UINT zero[4]{};
+                mrGfxContext()->ClearUnorderedAccessViewUint(ret->m_uav.get(), zero);
+            }
+            return ret;
+        }
+    }
     {
         D3D11_BUFFER_DESC desc{ size, D3D11_USAGE_DEFAULT, 0, 0, 0, stride };
         desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
@@ -253,6 +523,16 @@ ID3D11UnorderedAccessView* Buffer::uav() { return m_uav.get(); }
 int Buffer::getSize() const { return m_size; }
 int Buffer::getStride() const { return m_stride; }
 
+void Buffer::onRefCountZero()
+{
+    if (m_pooled && m_buffer) {
+        ResourcePool::BufferEntry e{ m_size, m_stride, std::move(m_buffer), std::move(m_staging), std::move(m_srv), std::move(m_uav) };
+        if (auto g = GfxGlobals::find())
+            g->getResourcePool().release(std::move(e));
+    }
+    delete this;
+}
+
 void Buffer::download(int size)
 {
     if (!m_staging) {
@@ -280,6 +560,22 @@ bool Buffer::read(const ReadCallback& callback, int size)
     return map(callback);
 }
 
+bool Buffer::upload(const void* data, int size)
+{
+    if (!m_buffer || size > m_size)
+        return false;
+
+    // WRITE_DISCARD lets the driver rename the buffer if the previous contents are still in flight.
+    auto ctx = mrGfxContext();
+    D3D11_MAPPED_SUBRESOURCE mapped{};
+    if (SUCCEEDED(ctx->Map(m_buffer.get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+        memcpy(mapped.pData, data, size);
+        ctx->Unmap(m_buffer.get(), 0);
+        return true;
+    }
+    return false;
+}
+
 
 Texture2DPtr Texture2D::create(uint32_t w, uint32_t h, TextureFormat format, const void* data, uint32_t pitch)
 {
@@ -289,6 +585,25 @@ Texture2DPtr Texture2D::create(uint32_t w, uint32_t h, TextureFormat format, con
     auto ret = make_ref<Texture2D>();
     ret->m_size = { (int)w, (int)h };
     ret->m_format = format;
+    ret->m_pooled = true;
+    if (!data) {
+        ResourcePool::TextureEntry e{ ret->m_size, format };
+        if (mrGfxGlobals()->getResourcePool().acquire(e)) {
+            ret->m_texture = std::move(e.texture);
+            ret->m_staging = std::move(e.staging);
+            ret->m_srv = std::move(e.srv);
+            ret->m_uav = std::move(e.uav);
+
+            // keep same result as newly created one. the pool is shared by threads, but the context is not.
+            if (ret->m_uav) {
+                mrGfxLockScope();
+                const UINT zero[4]{};
+                mrGfxContext()->ClearUnorderedAccessViewUint(ret->m_uav.get(), zero);
+            }
+            return ret;
+        }
+    }
+
     auto dxformat = GetDXFormat(format);
     {
         auto ts = ret->getInternalSize();
@@ -390,11 +705,21 @@ int2 Texture2D::getInternalSize() const
 {
     auto ret = m_size;
     if (m_format == TextureFormat::Binary)
-        ret.x = ceildiv(ret.x, 32);
+        ret.x = GetBinaryRowWords(ret.x) * 2; // DXGI_FORMAT_R32_UINT
     return ret;
 }
 TextureFormat Texture2D::getFormat() const { return m_format; }
 
+void Texture2D::onRefCountZero()
+{
+    if (m_pooled && m_texture) {
+        ResourcePool::TextureEntry e{ m_size, m_format, std::move(m_texture), std::move(m_staging), std::move(m_srv), std::move(m_uav) };
+        if (auto g = GfxGlobals::find())
+            g->getResourcePool().release(std::move(e));
+    }
+    delete this;
+}
+
 void Texture2D::download()
 {
     if (!m_staging) {
@@ -419,14 +744,58 @@ bool Texture2D::read(const ReadCallback& callback)
     return map(callback);
 }
 
-bool Texture2D::saveImpl(const std::string& path, int2 size, TextureFormat format, const void* data, int pitch)
+bool Texture2D::map(const void*& data, int& pitch, bool wait)
 {
+    if (!m_staging)
+        return false;
+
+    auto ctx = mrGfxContext();
+    mrGfxFlush();
+
+    D3D11_MAPPED_SUBRESOURCE mapped{};
+    if (SUCCEEDED(ctx->Map(m_staging.get(), 0, D3D11_MAP_READ, wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped))) {
+        data = mapped.pData;
+        pitch = mapped.RowPitch;
+        return true;
+    }
+    return false;
+}
+
+void Texture2D::unmap()
+{
+    if (m_staging)
+        mrGfxContext()->Unmap(m_staging.get(), 0);
+}
+
+bool Texture2D::saveImpl(const std::string& path, int2 size, TextureFormat format, const void* data, int pitch, bool fast)
+{
+    auto write_png = [fast](const std::string& dst, int w, int h, int channels, const void* pixels, int stride) -> bool {
+        return fast ? WritePNGFast(dst.c_str(), w, h, channels, pixels, stride) : stbi_write_png(dst.c_str(), w, h, channels, pixels, stride) != 0;
+    };
+
     bool ret = false;
     if (format == TextureFormat::RGBAu8) {
-        ret = stbi_write_png(path.c_str(), size.x, size.y, 4, data, pitch);
+        ret = write_png(path, size.x, size.y, 4, data, pitch);
+    }
+    else if (format == TextureFormat::BGRAu8) {
+        std::vector<uint32_t> buf(size.x * size.y);
+        for (int i = 0; i < size.y; ++i)
+            SwapRB(buf.data() + (size.x * i), (const uint32_t*)((const byte*)data + (pitch * i)), size.x);
+        ret = write_png(path, size.x, size.y, 4, buf.data(), size.x * 4);
     }
     else if (format == TextureFormat::Ru8) {
-        ret = stbi_write_png(path.c_str(), size.x, size.y, 1, data, pitch);
+        ret = write_png(path, size.x, size.y, 1, data, pitch);
+    }
+    else if (format == TextureFormat::Rf16) {
+        std::vector<byte> buf(size.x * size.y);
+        std::vector<float> row(size.x);
+        for (int i = 0; i < size.y; ++i) {
+            HalfToFloat(row.data(), (const half*)((const byte*)data + (pitch * i)), size.x);
+            auto d = buf.data() + (size.x * i);
+            for (float v : row)
+                *d++ = byte(std::clamp(v, 0.0f, 1.0f) * 255.0f);
+        }
+        ret = write_png(path, size.x, size.y, 1, buf.data(), size.x);
     }
     else if (format == TextureFormat::Rf32) {
         std::vector<byte> buf(size.x * size.y);
@@ -437,7 +806,7 @@ bool Texture2D::saveImpl(const std::string& path, int2 size, TextureFormat forma
                 *d++ = byte(*s++ * 255.0f);
             }
         }
-        ret = stbi_write_png(path.c_str(), size.x, size.y, 1, buf.data(), size.x);
+        ret = write_png(path, size.x, size.y, 1, buf.data(), size.x);
     }
     else if (format == TextureFormat::Binary) {
         // binary to gray scale
@@ -451,7 +820,7 @@ bool Texture2D::saveImpl(const std::string& path, int2 size, TextureFormat forma
                 *d++ = (s[pi] & (1 << bi)) ? 0xff : 0;
             }
         }
-        ret = stbi_write_png(path.c_str(), size.x, size.y, 1, buf.data(), size.x);
+        ret = write_png(path, size.x, size.y, 1, buf.data(), size.x);
     }
     else {
         mrDbgPrint("Texture2D::save(): unknown format\n");
@@ -462,7 +831,7 @@ bool Texture2D::saveImpl(const std::string& path, int2 size, TextureFormat forma
 bool Texture2D::save(const std::string& path)
 {
     // copy data to temporary buffer to minimize Map() time
-    std::vector<byte> buf;
+    HostVector<byte> buf;
     int pitch{};
     bool ret = read([&](const void* data, int pitch_) {
         pitch = pitch_;
@@ -478,18 +847,13 @@ bool Texture2D::save(const std::string& path)
 
 std::future<bool> Texture2D::saveAsync(const std::string& path)
 {
-    std::vector<byte> buf;
-    int pitch{};
-    bool ret = read([&](const void* data, int pitch_) {
-        pitch = pitch_;
-        buf.resize(pitch * m_size.y);
-        memcpy(buf.data(), data, buf.size());
-        });
-
-    return std::async(std::launch::async, [path, size = m_size, format = m_format, pitch, buf = std::move(buf)]() {
-        if (buf.empty())
-            return false;
-        return saveImpl(path, size, format, buf.data(), pitch);
+    // encoding is done by worker threads. if they are busy the request is dropped without reading the texture.
+    return mrGfxGlobals()->getImageWriter().write(path, m_size, m_format, [this](HostVector<byte>& buf, int& pitch) {
+        return read([&](const void* data, int pitch_) {
+            pitch = pitch_;
+            buf.resize(pitch * m_size.y);
+            memcpy(buf.data(), data, buf.size());
+            });
         });
 }
 
@@ -684,6 +1048,11 @@ bool MapRead(ID3D11Texture2D* src, const std::function<void(const void* data, in
     return false;
 }
 
+mrAPI ResourcePoolStats GetResourcePoolStats()
+{
+    return mrGfxGlobals()->getResourcePool().getStats();
+}
+
 mrAPI bool SaveAsPNG(const char* path, int w, int h, PixelFormat format, const void* data, int pitch, bool flip_y)
 {
     if (!path || !data)
@@ -702,21 +1071,13 @@ mrAPI bool SaveAsPNG(const char* path, int w, int h, PixelFormat format, const v
         return stbi_write_png(path, w, h, 1, data, pitch);
     }
     else if (format == PixelFormat::BGRAu8) {
-        std::vector<byte> buf(w * h * 4);
+        std::vector<uint32_t> buf(w * h);
         int dst_pitch = w * 4;
 
         auto src = (const byte*)data;
         for (int i = 0; i < h; ++i) {
             auto s = src + (flip_y ? (pitch * (h - i - 1)) : (pitch * i));
-            auto d = buf.data() + (dst_pitch * i);
-            for (int j = 0; j < w; ++j) {
-                d[0] = s[2];
-                d[1] = s[1];
-                d[2] = s[0];
-                d[3] = s[3];
-                s += 4;
-                d += 4;
-            }
+            SwapRB(buf.data() + (w * i), (const uint32_t*)s, w);
         }
         return stbi_write_png(path, w, h, 4, buf.data(), dst_pitch);
     }
@@ -33,22 +33,127 @@ private:
 };
 
 
+// recycles textures and structured buffers.
+// released resources are reused only after the GPU has passed a fence signaled after the release.
+class ResourcePool
+{
+public:
+    struct TextureEntry
+    {
+        int2 size{};
+        TextureFormat format{};
+        com_ptr<ID3D11Texture2D> texture;
+        com_ptr<ID3D11Texture2D> staging;
+        com_ptr<ID3D11ShaderResourceView> srv;
+        com_ptr<ID3D11UnorderedAccessView> uav;
+        uint64_t fence{};
+    };
+
+    struct BufferEntry
+    {
+        int size{};
+        int stride{};
+        com_ptr<ID3D11Buffer> buffer;
+        com_ptr<ID3D11Buffer> staging;
+        com_ptr<ID3D11ShaderResourceView> srv;
+        com_ptr<ID3D11UnorderedAccessView> uav;
+        uint64_t fence{};
+    };
+
+    // size & format (or size & stride) of dst are the key. resources are filled if found.
+    // can be called from any thread. the pool itself never touches the device context.
+    // reused resources must be cleared by the caller under the gfx lock (see Buffer::createStructured() & Texture2D::create()).
+    bool acquire(TextureEntry& dst);
+    bool acquire(BufferEntry& dst);
+    void release(TextureEntry&& v);
+    void release(BufferEntry&& v);
+    void clear();
+    ResourcePoolStats getStats();
+
+    // true if resources were released since the last call. the render thread signals a fence at flush so that they become reusable.
+    bool popFenceRequest();
+
+private:
+    template<class Entry, class Match>
+    bool acquireImpl(std::deque<Entry>& entries, Entry& dst, const Match& match);
+    template<class Entry>
+    void releaseImpl(std::deque<Entry>& entries, Entry&& v);
+    void trim();
+
+    std::mutex m_mutex;
+    std::deque<TextureEntry> m_textures;
+    std::deque<BufferEntry> m_buffers;
+    size_t m_pooled_bytes = 0;
+    uint64_t m_reused = 0;
+    uint64_t m_created = 0;
+    std::atomic_bool m_fence_requested{ false };
+};
+
+
+// writes images on worker threads. mainly for debug dumps.
+// the queue is bounded and new jobs are dropped when it is full, so the caller never stalls.
+class ImageWriter
+{
+public:
+    // fills image data and its pitch. called on the caller's thread only if the job is accepted.
+    using ReadFunc = std::function<bool(HostVector<byte>& dst, int& pitch)>;
+
+    ImageWriter();
+    ~ImageWriter();
+    ImageWriter(const ImageWriter&) = delete;
+
+    // returned future becomes false if the job is dropped or failed.
+    std::future<bool> write(const std::string& path, int2 size, TextureFormat format, const ReadFunc& read);
+    void wait(); // until all queued jobs are done
+    int getDroppedCount() const;
+
+private:
+    struct Job
+    {
+        std::string path;
+        int2 size{};
+        TextureFormat format{};
+        HostVector<byte> data;
+        int pitch{};
+        std::promise<bool> result;
+    };
+
+    void startThreads();
+    void workerThread();
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::condition_variable m_cond_done;
+    std::deque<Job> m_queue;
+    std::vector<std::thread> m_threads;
+    int m_busy = 0;
+    size_t m_reserved = 0; // jobs accepted and being read. counted in the bound
+    bool m_closing = false;
+    std::atomic_int m_dropped{ 0 };
+};
+
+
 class GfxGlobals
 {
 public:
     static GfxGlobals* get();
+    static GfxGlobals* find(); // returns null if not initialized or already finalized
 
     bool valid() const;
     ID3D11Device5* getDevice();
     ID3D11DeviceContext4* getContext();
 
     uint64_t addFenceEvent();
+    uint64_t getFenceValue() const; // last signaled
+    uint64_t getCompletedFenceValue();
     bool waitFence(uint64_t v, uint32_t timeout_ms = 1000);
     void flush();
     bool sync(int timeout_ms = 1000);
 
     ID3D11SamplerState* getPointSampler();
     ID3D11SamplerState* getLinearSampler();
+    ResourcePool& getResourcePool();
+    ImageWriter& getImageWriter();
 
     void lock();
     void unlock();
@@ -75,12 +180,18 @@ private:
 
     com_ptr<ID3D11Fence> m_fence;
     FenceEvent m_fence_event;
-    uint64_t m_fence_value = 0;
+    std::atomic<uint64_t> m_fence_value{ 0 };
 
     com_ptr<ID3D11SamplerState> m_sampler_point;
     com_ptr<ID3D11SamplerState> m_sampler_linear;
 
-    std::mutex m_mutex;
+    // recursive: resources are created (and pooled ones cleared) under the lock, both from code that already holds it
+    // (e.g. ScreenMatcher) and from code that doesn't.
+    std::recursive_mutex m_mutex;
+    ResourcePool m_resource_pool;
+    ImageWriter m_image_writer;
+
+    static GfxGlobals* s_instance;
 
     // shaders
 #define Body(Name) Name##CSPtr m_cs_##Name;
@@ -130,6 +241,18 @@ public:
         return createConstant(sizeof(v), &v);
     }
 
+    // update dst in place if it is a constant buffer of the same size. otherwise create new one.
+    // constant buffers are dynamic, so parameter changes don't allocate device objects in steady state.
+    template<class T>
+    static inline bool updateConstant(BufferPtr& dst, const T& v)
+    {
+        mrCheck16(T);
+        if (dst && dst->getSize() == sizeof(v))
+            return dst->upload(&v, sizeof(v));
+        dst = createConstant(sizeof(v), &v);
+        return dst != nullptr;
+    }
+
     bool operator==(const Buffer& v) const;
     bool operator!=(const Buffer& v) const;
     bool valid() const override;
@@ -143,12 +266,17 @@ public:
     void download(int size = 0) override;
     bool map(const ReadCallback& callback) override;
     bool read(const ReadCallback& callback, int size = 0) override; // download() & map()
+    bool upload(const void* data, int size); // dynamic buffer only
 
     com_ptr<ID3D11Buffer>& get() { return m_buffer; }
 
+protected:
+    void onRefCountZero() override;
+
 private:
     int m_size{};
     int m_stride{};
+    bool m_pooled = false;
     com_ptr<ID3D11Buffer> m_buffer;
     com_ptr<ID3D11Buffer> m_staging;
     com_ptr<ID3D11ShaderResourceView> m_srv;
@@ -179,16 +307,23 @@ public:
     void download() override;
     bool map(const ReadCallback& callback) override;
     bool read(const ReadCallback& callback) override;
+    bool map(const void*& data, int& pitch, bool wait = true) override;
+    void unmap() override;
 
-    static bool saveImpl(const std::string& path, int2 size, TextureFormat format, const void* data, int pitch);
+    // fast: low compression for debug dumps. see mrFastPNG.cpp
+    static bool saveImpl(const std::string& path, int2 size, TextureFormat format, const void* data, int pitch, bool fast = false);
     bool save(const std::string& path) override;
     std::future<bool> saveAsync(const std::string& path) override;
 
     com_ptr<ID3D11Texture2D>& get() { return m_texture; }
 
+protected:
+    void onRefCountZero() override;
+
 private:
     int2 m_size{};
     TextureFormat m_format{};
+    bool m_pooled = false;
     com_ptr<ID3D11Texture2D> m_texture;
     com_ptr<ID3D11Texture2D> m_staging;
     com_ptr<ID3D11ShaderResourceView> m_srv;
@@ -234,6 +369,7 @@ public:
 TextureFormat GetMRFormat(DXGI_FORMAT f);
 DXGI_FORMAT GetDXFormat(TextureFormat f);
 bool IsIntFormat(TextureFormat f);
+bool WritePNGFast(const char* path, int w, int h, int channels, const void* data, int pitch); // mrFastPNG.cpp
 
 void DispatchCopy(ID3D11Resource* dst, ID3D11Resource* src);
 void DispatchCopy(ID3D11Resource* dst, ID3D11Resource* src, int size, int src_offset = 0, int dst_offset = 0);
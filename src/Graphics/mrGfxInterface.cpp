@@ -11,6 +11,7 @@ public:
     ITexture2DPtr createTexture(int w, int h, TextureFormat f, const void* data, int pitch) override;
     ITexture2DPtr createTextureFromFile(const char* path) override;
     IScreenCapturePtr createScreenCapture() override;
+    IScreenCapturePtr createScreenCaptureFromFiles(const char* path, bool realtime) override;
 
 #define Body(Name) I##Name##Ptr create##Name() override;
 mrEachCS(Body)
@@ -46,6 +47,11 @@ IScreenCapturePtr GfxInterface::createScreenCapture()
     //return CreateDesktopDuplication();
 }
 
+IScreenCapturePtr GfxInterface::createScreenCaptureFromFiles(const char* path, bool realtime)
+{
+    return CreateImageSequenceCapture(path, realtime);
+}
+
 #define Body(Name) I##Name##Ptr GfxInterface::create##Name() { return mrGfxGetCS(Name##CS)->createContext(); }
 mrEachCS(Body)
 #undef Body
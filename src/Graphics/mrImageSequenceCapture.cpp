@@ -0,0 +1,272 @@
+#include "pch.h"
+#include "mrInternal.h"
+#include "mrScreenCapture.h"
+
+#ifdef mrWithImageSequenceCapture
+namespace mr {
+
+// serves frames from image files instead of a display. for offline / headless replay and benchmarking.
+//
+// path can be:
+//  - a frame archive (*.mrfa) written by IFrameArchiveWriter.
+//  - a manifest file (*.txt). each line is "<present_time in ns> <image path>". image paths are relative to the manifest.
+//  - a directory that contains "frames.txt" manifest.
+//  - a directory that contains only *.png. frames are sorted by file name and paced at 60Hz.
+//
+// startCapture() ignores its target. frames are always served from the files.
+class ImageSequenceCapture : public ScreenCaptureCommon
+{
+public:
+    struct FrameEntry
+    {
+        nanosec present_time{};
+        std::string path; // empty if served from archive
+    };
+
+    ImageSequenceCapture(const char* path, bool realtime);
+    ~ImageSequenceCapture() override;
+    bool valid() const;
+
+    bool startCapture(HWND hwnd) override;
+    bool startCapture(HMONITOR hmon) override;
+    void stopCapture() override;
+    bool isCapturing() const override;
+
+    FrameInfo getFrame() override;
+    FrameInfo waitNextFrame() override;
+
+private:
+    bool loadManifest(const std::filesystem::path& path);
+    bool loadDirectory(const std::filesystem::path& path);
+    bool loadArchive(const std::filesystem::path& path);
+    bool startImpl();
+    bool serveFrame(size_t i);
+    void playbackThread();
+
+    std::vector<FrameEntry> m_frames;
+    IFrameArchiveReaderPtr m_archive;
+    HostVector<byte> m_archive_buffer;
+    bool m_realtime = true;
+    size_t m_next_frame = 0;
+    std::mutex m_serve_mutex; // non-realtime mode: consumers serve frames themselves. TripleBuffer needs a single producer.
+    std::atomic_bool m_capturing{ false };
+    std::atomic_bool m_stop_requested{ false };
+    std::thread m_thread;
+};
+
+
+ImageSequenceCapture::ImageSequenceCapture(const char* path_, bool realtime)
+    : m_realtime(realtime)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::path path = path_;
+    if (fs::is_directory(path, ec)) {
+        if (fs::exists(path / "frames.txt", ec))
+            loadManifest(path / "frames.txt");
+        else
+            loadDirectory(path);
+    }
+    else if (path.extension() == ".mrfa") {
+        loadArchive(path);
+    }
+    else {
+        loadManifest(path);
+    }
+}
+
+ImageSequenceCapture::~ImageSequenceCapture()
+{
+    stopCapture();
+}
+
+bool ImageSequenceCapture::valid() const
+{
+    return !m_frames.empty();
+}
+
+bool ImageSequenceCapture::loadManifest(const std::filesystem::path& path)
+{
+    std::ifstream ifs(path, std::ios::in);
+    if (!ifs)
+        return false;
+
+    auto dir = path.parent_path();
+    std::string l;
+    while (std::getline(ifs, l)) {
+        if (l.empty() || l.front() == '#')
+            continue;
+
+        unsigned long long time{};
+        char file[MAX_PATH]{};
+        if (sscanf(l.c_str(), "%llu %259[^\r\n]", &time, file) == 2)
+            m_frames.push_back({ time, (dir / file).string() });
+    }
+    std::stable_sort(m_frames.begin(), m_frames.end(),
+        [](auto& a, auto& b) { return a.present_time < b.present_time; });
+    return !m_frames.empty();
+}
+
+bool ImageSequenceCapture::loadDirectory(const std::filesystem::path& path)
+{
+    namespace fs = std::filesystem;
+    const nanosec interval = 1000000000 / 60;
+
+    std::vector<std::string> files;
+    std::error_code ec;
+    for (auto& e : fs::directory_iterator(path, ec)) {
+        if (e.is_regular_file() && e.path().extension() == ".png")
+            files.push_back(e.path().string());
+    }
+    std::sort(files.begin(), files.end());
+
+    nanosec time = interval;
+    for (auto& f : files) {
+        m_frames.push_back({ time, f });
+        time += interval;
+    }
+    return !m_frames.empty();
+}
+
+bool ImageSequenceCapture::loadArchive(const std::filesystem::path& path)
+{
+    m_archive = OpenFrameArchive(path.string().c_str());
+    if (!m_archive)
+        return false;
+
+    int n = m_archive->getFrameCount();
+    for (int i = 0; i < n; ++i)
+        m_frames.push_back({ m_archive->getTime(i), {} });
+    return !m_frames.empty();
+}
+
+bool ImageSequenceCapture::startImpl()
+{
+    stopCapture();
+    if (m_frames.empty())
+        return false;
+
+    {
+        std::unique_lock l(m_serve_mutex);
+        m_next_frame = 0;
+    }
+    m_stop_requested = false;
+    m_capturing = true;
+    if (m_realtime)
+        m_thread = std::thread([this]() { playbackThread(); });
+    return true;
+}
+
+bool ImageSequenceCapture::startCapture(HWND hwnd)
+{
+    return startImpl();
+}
+
+bool ImageSequenceCapture::startCapture(HMONITOR hmon)
+{
+    return startImpl();
+}
+
+void ImageSequenceCapture::stopCapture()
+{
+    m_stop_requested = true;
+    if (m_thread.joinable())
+        m_thread.join();
+    m_capturing = false;
+}
+
+bool ImageSequenceCapture::isCapturing() const
+{
+    return m_capturing;
+}
+
+bool ImageSequenceCapture::serveFrame(size_t i)
+{
+    if (i >= m_frames.size())
+        return false;
+
+    auto& entry = m_frames[i];
+    Texture2DPtr surface;
+    if (m_archive) {
+        auto size = m_archive->getSize();
+        m_archive_buffer.resize(size.x * size.y * 4);
+        if (m_archive->readFrame((int)i, m_archive_buffer.data()))
+            surface = Texture2D::create(size.x, size.y, m_archive->getFormat(), m_archive_buffer.data(), size.x * 4);
+    }
+    else {
+        surface = Texture2D::create(entry.path.c_str());
+    }
+    if (!surface) {
+        mrDbgPrint("*** ImageSequenceCapture: failed to load frame %d ***\n", (int)i);
+        return false;
+    }
+    updateFrame(surface, {}, entry.present_time);
+    return true;
+}
+
+void ImageSequenceCapture::playbackThread()
+{
+    // keep intervals between recorded present_time. frames are scheduled from the start time, so loading time doesn't accumulate.
+    auto time_start = std::chrono::steady_clock::now();
+    nanosec first = m_frames.front().present_time;
+    for (size_t i = 0; i < m_frames.size() && !m_stop_requested; ++i) {
+        auto deadline = time_start + std::chrono::nanoseconds(m_frames[i].present_time - first);
+        while (!m_stop_requested && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_until(std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(10)));
+        serveFrame(i);
+    }
+    m_capturing = false;
+
+    // release waitNextFrame() waiters. no frames will come anymore.
+    releaseWaiters();
+}
+
+IScreenCapture::FrameInfo ImageSequenceCapture::getFrame()
+{
+    if (!m_realtime) {
+        std::unique_lock l(m_serve_mutex);
+        if (m_capturing && m_next_frame == 0)
+            serveFrame(m_next_frame++);
+        return ScreenCaptureCommon::getFrame();
+    }
+    return ScreenCaptureCommon::getFrame();
+}
+
+IScreenCapture::FrameInfo ImageSequenceCapture::waitNextFrame()
+{
+    if (m_realtime) {
+        // load the sequence before checking m_capturing. playbackThread() clears m_capturing before releaseWaiters(),
+        // so if it ends in between, the sequence has moved and wait() returns immediately.
+        uint64_t seq = m_frame_seq.load(std::memory_order_acquire);
+        if (!m_capturing)
+            return ScreenCaptureCommon::getFrame();
+        m_frame_seq.wait(seq, std::memory_order_acquire);
+        return ScreenCaptureCommon::getFrame();
+    }
+    else {
+        // as fast as possible: every call advances one frame. the last frame is kept at the end of the sequence.
+        std::unique_lock l(m_serve_mutex);
+        if (m_capturing) {
+            serveFrame(m_next_frame++);
+            if (m_next_frame >= m_frames.size())
+                m_capturing = false;
+        }
+        return ScreenCaptureCommon::getFrame();
+    }
+}
+
+IScreenCapture* CreateImageSequenceCapture_(const char* path, bool realtime)
+{
+    if (!path)
+        return nullptr;
+
+    auto ret = new ImageSequenceCapture(path, realtime);
+    if (!ret->valid()) {
+        delete ret;
+        ret = nullptr;
+    }
+    return ret;
+}
+
+} // namespace mr
+#endif // mrWithImageSequenceCapture
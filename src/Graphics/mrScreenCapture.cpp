@@ -6,31 +6,21 @@ namespace mr {
 
 IScreenCapture::FrameInfo ScreenCaptureCommon::getFrame()
 {
-    FrameInfo ret;
-    {
-        std::unique_lock l(m_mutex);
-        ret = m_frame_info;
-    }
-    return ret;
+    std::unique_lock l(m_consumer_mutex);
+    m_frames.update();
+    return m_frames.front();
 }
 
 IScreenCapture::FrameInfo ScreenCaptureCommon::waitNextFrame()
 {
-    FrameInfo ret;
-    {
-        std::unique_lock l(m_mutex);
-        m_waiting_next_frame = true;
-        m_cond.wait(l, [this]() { return m_waiting_next_frame == false; });
-
-        ret = m_frame_info;
-    }
-    return ret;
+    uint64_t seq = m_frame_seq.load(std::memory_order_acquire);
+    m_frame_seq.wait(seq, std::memory_order_acquire);
+    return getFrame();
 }
 
 void ScreenCaptureCommon::setOnFrameArrived(const Callback& cb)
 {
-    std::unique_lock l(m_mutex);
-    m_callback = cb;
+    m_callback.store(cb ? std::make_shared<Callback>(cb) : nullptr);
 }
 
 void ScreenCaptureCommon::updateFrame(com_ptr<ID3D11Texture2D>& surface, int2 size, nanosec time)
@@ -41,22 +31,26 @@ void ScreenCaptureCommon::updateFrame(com_ptr<ID3D11Texture2D>& surface, int2 si
     else
         tex = m_prev_surface = Texture2D::wrap(surface);
 
+    updateFrame(tex, size, time);
+}
+
+void ScreenCaptureCommon::updateFrame(Texture2DPtr tex, int2 size, nanosec time)
+{
     if (size == int2::zero())
         size = tex->getSize();
 
-    FrameInfo tmp{ tex, size, time };
-    {
-        std::unique_lock l(m_mutex);
-        m_frame_info = tmp;
-
-        if (m_callback)
-            m_callback(m_frame_info);
+    FrameInfo& dst = m_frames.back();
+    dst = { tex, size, time };
+    if (auto cb = m_callback.load())
+        (*cb)(dst);
+    m_frames.publish();
+    releaseWaiters();
+}
 
-        if (m_waiting_next_frame) {
-            m_waiting_next_frame = false;
-            m_cond.notify_one();
-        }
-    }
+void ScreenCaptureCommon::releaseWaiters()
+{
+    m_frame_seq.fetch_add(1, std::memory_order_acq_rel);
+    m_frame_seq.notify_all();
 }
 
 } // namespace mr
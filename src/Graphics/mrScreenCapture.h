@@ -3,6 +3,7 @@
 
 #define mrWithDesktopDuplicationAPI
 #define mrWithWindowsGraphicsCapture
+#define mrWithImageSequenceCapture
 
 namespace mr {
 
@@ -14,15 +15,20 @@ public:
     void setOnFrameArrived(const Callback& cb) override;
 
 protected:
+    // producer side. called from the capture thread and never blocks.
     void updateFrame(com_ptr<ID3D11Texture2D>& surface, int2 size, nanosec time);
+    void updateFrame(Texture2DPtr surface, int2 size, nanosec time);
+    // wake up waitNextFrame() without a new frame (e.g. end of capture).
+    void releaseWaiters();
 
 protected:
-    Callback m_callback;
+    std::atomic<std::shared_ptr<Callback>> m_callback;
 
-    FrameInfo m_frame_info;
-    std::mutex m_mutex;
-    std::condition_variable m_cond;
-    bool m_waiting_next_frame{ false };
+    // frames are handed over via triple buffer. the producer never waits for consumers.
+    // consumers are serialized by m_consumer_mutex, which the producer never touches.
+    TripleBuffer<FrameInfo> m_frames;
+    std::mutex m_consumer_mutex;
+    std::atomic<uint64_t> m_frame_seq{ 0 };
 
     Texture2DPtr m_prev_surface;
 };
@@ -44,4 +50,12 @@ mrDefShared(CreateGraphicsCapture);
 
 #endif // mrWithWindowsGraphicsCapture
 
+
+#ifdef mrWithImageSequenceCapture
+
+IScreenCapture* CreateImageSequenceCapture_(const char* path, bool realtime);
+inline IScreenCapturePtr CreateImageSequenceCapture(const char* path, bool realtime) { return CreateImageSequenceCapture_(path, realtime); }
+
+#endif // mrWithImageSequenceCapture
+
 } // namespace mr
@@ -41,10 +41,23 @@ class ScreenMatcher : public RefCount<IScreenMatcher>
 public:
     using DeferredResult = std::future<Result>;
 
-    struct ScreenData
+    // preprocessing stages. each stage is computed only when a template needs it.
+    enum class Stage : uint32_t
     {
+        Grayscale   = 1 << 0,
+        Binary      = 1 << 1,
+        Contour     = 1 << 2, // contour & contour_b
+    };
+
+    // preprocessed frame of a monitor.
+    // shared with all instances that have same preprocessing params, so same frame is not filtered twice.
+    // instances may be on different threads. mutex is held (inside the gfx lock) from preprocessing until the results are read.
+    struct ScreenData : public RefCount<IObject>
+    {
+        std::mutex mutex;
         MonitorInfo info;
         IScreenCapturePtr capture;
+        Params params;
 
         IFilterSetPtr filter;
         ITexture2DPtr surface;
@@ -56,7 +69,10 @@ public:
         ITexture2DPtr match_f;
         ITexture2DPtr match_i;
         nanosec last_frame{};
+        Rect roi{}; // preprocessed region in screen coordinate. buffers are always the size of the monitor
+        uint32_t stages{}; // Stage flags already computed for last_frame & roi
     };
+    using ScreenDataPtr = ref_ptr<ScreenData>;
 
     ScreenMatcher(const Params& params);
     ~ScreenMatcher();
@@ -67,11 +83,17 @@ public:
     IReduceMinMaxPtr pullReduceMinmax();
     void pushReduceMinmax(IReduceMinMaxPtr v);
 
-    void updateScreen(ScreenData& sd);
+    static bool isSamePreprocess(const Params& a, const Params& b);
+    ScreenDataPtr findOrCreateScreenData(const MonitorInfo& info, IScreenCapturePtr capture);
+    void createBuffers(ScreenData& sd);
+    Rect getBufferRegion(const ScreenData& sd, Rect rect) const;
+    static uint32_t getRequiredStages(std::span<ITemplatePtr> tmpls);
+    void updateScreen(ScreenData& sd, Rect roi, uint32_t stages);
     void matchImpl(Template& tmpl, ScreenData& sd, Rect rect);
     Result reduceResults(std::span<ITemplatePtr> tmpl);
     Result match(std::span<ITemplatePtr> tmpl, HMONITOR target) override;
     Result match(std::span<ITemplatePtr> tmpl, HWND target) override;
+    Result match(std::span<ITemplatePtr> tmpl, Rect region) override;
 
 private:
     // shared with all instances
@@ -83,14 +105,16 @@ private:
             IScreenCapturePtr capture;
         };
         std::vector<ScreenData> screens;
+        std::vector<ScreenMatcher::ScreenDataPtr> frames;
     };
     static SharedData* s_data;
+    static std::mutex s_mutex; // guards s_data and s_data->frames
 
     IGfxInterfacePtr m_gfx;
     Params m_params;
 
     std::map<std::string, ITemplatePtr> m_templates;
-    std::map<HMONITOR, ScreenData> m_screens;
+    std::map<HMONITOR, ScreenDataPtr> m_screens;
 
     std::deque<IReduceMinMaxPtr> m_reducers;
     std::vector<DeferredResult> m_deferred_results;
@@ -126,11 +150,13 @@ Template::Image& Template::getImage(float display_scale_factor)
 
 
 ScreenMatcher::SharedData* ScreenMatcher::s_data;
+std::mutex ScreenMatcher::s_mutex;
 
 ScreenMatcher::ScreenMatcher(const Params& params)
     : m_gfx(GetGfxInterface())
     , m_params(params)
 {
+    std::unique_lock l(s_mutex);
     if (!s_data) {
         s_data = new SharedData();
 
@@ -145,28 +171,17 @@ ScreenMatcher::ScreenMatcher(const Params& params)
     }
     s_data->addRef();
 
-    for (auto& sd : s_data->screens) {
-        ScreenData data;
-        data.info = sd.info;
-        data.capture = sd.capture;
-
-        data.filter = CreateFilterSet();
-
-        int2 size = int2(float2(data.info.rect.size) * m_params.scale);
-        data.grayscale  = m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
-        data.biased     = m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
-        data.binary     = m_gfx->createTexture(size.x, size.y, TextureFormat::Binary);
-        data.contour    = m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
-        data.contour_b  = m_gfx->createTexture(size.x, size.y, TextureFormat::Binary);
-        data.match_f    = m_gfx->createTexture(size.x, size.y, TextureFormat::Rf32);
-        data.match_i    = m_gfx->createTexture(size.x, size.y, TextureFormat::Ri32);
-
-        m_screens[sd.info.hmon] = std::move(data);
-    }
+    for (auto& sd : s_data->screens)
+        m_screens[sd.info.hmon] = findOrCreateScreenData(sd.info, sd.capture);
 }
 
 ScreenMatcher::~ScreenMatcher()
 {
+    // release preprocessed frames no other instances are using
+    m_screens.clear();
+    std::unique_lock l(s_mutex);
+    std::erase_if(s_data->frames, [](auto& f) { return f->getRef() == 1; });
+
     if (s_data->release() == 0)
         s_data = nullptr;
 }
@@ -176,11 +191,23 @@ bool ScreenMatcher::valid() const
     return !m_screens.empty();
 }
 
+// createTemplate() and match() take the gfx lock for their whole duration. the lock is recursive, so callers may hold it.
+// all instances share the immediate context, and players may use them from their own threads.
 ITemplatePtr ScreenMatcher::createTemplate(const char* path)
 {
+    mrGfxLockScope();
+
+    // m_templates holds the images of each path. callers get their own template sharing them, so setting the match
+    // pattern of one never changes another that may be in use by match().
+    auto share = [](Template& src) {
+        auto ret = make_ref<Template>();
+        ret->images = src.images;
+        ret->base_image = src.base_image;
+        return ret;
+    };
     auto it = m_templates.find(path);
     if (it != m_templates.end())
-        return it->second;
+        return share(cast(*it->second));
 
     auto base_image = m_gfx->createTextureFromFile(path);
     if (!base_image)
@@ -203,16 +230,23 @@ ITemplatePtr ScreenMatcher::createTemplate(const char* path)
         img.scale_factor= scale_factor;
         img.grayscale   = m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
         img.binary      = m_gfx->createTexture(size.x, size.y, TextureFormat::Binary);
-        img.contour     = m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
         img.contour_b   = m_gfx->createTexture(size.x, size.y, TextureFormat::Binary);
         img.mask        = m_gfx->createTexture(size.x, size.y, TextureFormat::Binary);
 
+        filter->beginGraph();
         filter->grayscale(img.grayscale, base_image, m_params.color_range);
         filter->binarize(img.binary, img.grayscale, m_params.binarize_threshold);
-
-        filter->contour(img.contour, img.grayscale, m_params.contour_radius);
-        filter->binarize(img.contour_b, img.contour, m_params.binarize_threshold);
+        {
+            // grayscale contour is kept only for debugging. otherwise the graph fuses contour & binarize.
+            auto contour = m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
+            filter->contour(contour, img.grayscale, m_params.contour_radius);
+            filter->binarize(img.contour_b, contour, m_params.binarize_threshold);
+#ifdef mrDebug
+            img.contour = contour;
+#endif
+        }
         filter->expand(img.mask, img.contour_b, m_params.expand_radius);
+        filter->endGraph();
         img.mask_bits = filter->countBits(img.mask).get();
 
 #ifdef mrDebug
@@ -231,13 +265,13 @@ ITemplatePtr ScreenMatcher::createTemplate(const char* path)
 
     if (m_params.care_display_scale) {
         for (auto& kvp : m_screens)
-            create_image(kvp.second.info.scale_factor);
+            create_image(kvp.second->info.scale_factor);
     }
     else {
         create_image(1.0f);
     }
 
-    return ret;
+    return share(*ret);
 }
 
 IReduceMinMaxPtr ScreenMatcher::pullReduceMinmax()
@@ -258,31 +292,144 @@ void ScreenMatcher::pushReduceMinmax(IReduceMinMaxPtr v)
     m_reducers.push_back(v);
 }
 
-void ScreenMatcher::updateScreen(ScreenData& sd)
+bool ScreenMatcher::isSamePreprocess(const Params& a, const Params& b)
+{
+    // care_display_scale and expand_radius affect only templates
+    return a.scale == b.scale &&
+        a.color_range == b.color_range &&
+        a.contour_radius == b.contour_radius &&
+        a.binarize_threshold == b.binarize_threshold;
+}
+
+// called with s_mutex locked
+ScreenMatcher::ScreenDataPtr ScreenMatcher::findOrCreateScreenData(const MonitorInfo& info, IScreenCapturePtr capture)
+{
+    for (auto& f : s_data->frames) {
+        if (f->info.hmon == info.hmon && isSamePreprocess(f->params, m_params))
+            return f;
+    }
+
+    auto ret = make_ref<ScreenData>();
+    ret->info = info;
+    ret->capture = capture;
+    ret->params = m_params;
+    ret->filter = CreateFilterSet();
+    ret->roi = info.rect;
+    createBuffers(*ret);
+    s_data->frames.push_back(ret);
+    return ret;
+}
+
+void ScreenMatcher::createBuffers(ScreenData& sd)
+{
+    int2 size = int2(float2(sd.info.rect.size) * m_params.scale);
+    sd.grayscale    = m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
+    sd.biased       = m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
+    sd.binary       = m_gfx->createTexture(size.x, size.y, TextureFormat::Binary);
+#ifdef mrDebug
+    sd.contour      = m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
+#endif
+    sd.contour_b    = m_gfx->createTexture(size.x, size.y, TextureFormat::Binary);
+    sd.match_f      = m_gfx->createTexture(size.x, size.y, TextureFormat::Rf16); // holds mean difference. half is enough
+    sd.match_i      = m_gfx->createTexture(size.x, size.y, TextureFormat::Ri32);
+}
+
+// rect (screen coordinate) to the region in buffers.
+// x is extended to 32 pixel boundaries so that words of Binary buffers are entirely inside the region.
+Rect ScreenMatcher::getBufferRegion(const ScreenData& sd, Rect rect) const
+{
+    int2 size = sd.grayscale->getSize();
+    int2 tl = int2(float2(rect.pos - sd.info.rect.pos) * m_params.scale);
+    int2 br = int2(ceil(float2(rect.pos + rect.size - sd.info.rect.pos) * m_params.scale));
+    tl.x = tl.x / 32 * 32;
+    br.x = ceildiv(br.x, 32) * 32;
+    return Rect{ tl, br - tl }.intersect(Rect{ {}, size });
+}
+
+uint32_t ScreenMatcher::getRequiredStages(std::span<ITemplatePtr> tmpls)
+{
+    uint32_t ret = 0;
+    for (auto& t : tmpls) {
+        switch (cast(*t).match_pattern) {
+        case ITemplate::MatchPattern::Grayscale:
+            set_flag(ret, Stage::Grayscale, true);
+            break;
+        case ITemplate::MatchPattern::Binary:
+            set_flag(ret, Stage::Binary, true);
+            break;
+        default:
+            set_flag(ret, Stage::Contour, true);
+            break;
+        }
+    }
+    return ret;
+}
+
+// called with sd.mutex locked
+void ScreenMatcher::updateScreen(ScreenData& sd, Rect roi, uint32_t stages)
 {
     auto frame = sd.capture->getFrame();
     if (!frame.surface)
         return;
 
+    // preprocess only the region of interest. buffers keep the size of the monitor and only the region is written,
+    // so matching different regions (e.g. re-checking a prefetched result) doesn't reallocate them.
+    // keep a border of contour_radius (in screen pixels) so that contours at the edges are same as full screen.
+    int border = (int)std::ceil(m_params.contour_radius / m_params.scale);
+    roi = roi.expand(border).intersect(sd.info.rect);
+    if (roi.size.x <= 0 || roi.size.y <= 0)
+        return;
+
     if (frame.present_time != sd.last_frame) {
-        // make binarized surface
         sd.last_frame = frame.present_time;
         sd.surface = frame.surface;
-        sd.filter->grayscale(sd.grayscale, sd.surface, m_params.color_range);
-        sd.filter->binarize(sd.binary, sd.grayscale, m_params.binarize_threshold);
+        sd.roi = roi;
+        sd.stages = 0;
+    }
+    else if (roi.intersect(sd.roi) != roi) {
+        // another instance preprocessed a different region of this frame. grow the region to cover both.
+        roi = roi.merge(sd.roi);
+        sd.roi = roi;
+        sd.stages = 0;
+    }
+    auto region = getBufferRegion(sd, sd.roi);
+
+    // all other stages depend on grayscale
+    if (stages != 0)
+        set_flag(stages, Stage::Grayscale, true);
+    uint32_t todo = stages & ~sd.stages;
+    if (todo == 0)
+        return;
 
-        sd.filter->contour(sd.contour, sd.grayscale, m_params.contour_radius);
-        sd.filter->binarize(sd.contour_b, sd.contour, m_params.binarize_threshold);
+    sd.filter->beginGraph();
+    if (get_flag(todo, Stage::Grayscale)) {
+        sd.filter->grayscale(sd.grayscale, sd.surface, m_params.color_range, {}, region);
+    }
+    if (get_flag(todo, Stage::Binary)) {
+        sd.filter->binarize(sd.binary, sd.grayscale, m_params.binarize_threshold, region);
+    }
+    if (get_flag(todo, Stage::Contour)) {
+        // grayscale contour is kept only for debugging. otherwise it is a temporary and the graph fuses contour & binarize.
+        auto size = sd.grayscale->getSize();
+        auto contour = sd.contour ? sd.contour : m_gfx->createTexture(size.x, size.y, TextureFormat::Ru8);
+        sd.filter->contour(contour, sd.grayscale, m_params.contour_radius, region);
+        sd.filter->binarize(sd.contour_b, contour, m_params.binarize_threshold, region);
+    }
+    sd.filter->endGraph();
+    sd.stages |= todo;
 
 #ifdef mrDebug
-        if (g_dbg_sm_writeout) {
-            mrDbgPrint("writing frame %llu\n", sd.last_frame);
-            sd.grayscale->save(Format("frame_%llu_grayscale.png", sd.last_frame));
-            sd.binary->save(Format("frame_%llu_binary.png", sd.last_frame));
-            sd.contour->save(Format("frame_%llu_contour.png", sd.last_frame));
-        }
-#endif
+    if (g_dbg_sm_writeout) {
+        // async & lossy. frames are dropped if the writer can't keep up.
+        mrDbgPrint("writing frame %llu\n", sd.last_frame);
+        if (get_flag(todo, Stage::Grayscale))
+            sd.grayscale->saveAsync(Format("frame_%llu_grayscale.png", sd.last_frame));
+        if (get_flag(todo, Stage::Binary))
+            sd.binary->saveAsync(Format("frame_%llu_binary.png", sd.last_frame));
+        if (get_flag(todo, Stage::Contour))
+            sd.contour->saveAsync(Format("frame_%llu_contour.png", sd.last_frame));
     }
+#endif
 }
 
 void ScreenMatcher::matchImpl(Template& tmpl, ScreenData& sd, Rect rect)
@@ -291,6 +438,7 @@ void ScreenMatcher::matchImpl(Template& tmpl, ScreenData& sd, Rect rect)
 
     float scale = m_params.scale;
 
+    rect = rect.intersect(sd.roi);
     auto region = Rect{
         rect.pos - sd.info.rect.pos,
         rect.size
@@ -342,7 +490,8 @@ void ScreenMatcher::matchImpl(Template& tmpl, ScreenData& sd, Rect rect)
 
         switch (tmpl.match_pattern) {
         case ITemplate::MatchPattern::Grayscale:
-            ret.score = float(double(mm.valf_min) / double(tsize.x * tsize.y));
+            // match_f is Rf16. TemplateMatch already divided by template area.
+            ret.score = mm.valf_min;
             break;
         case ITemplate::MatchPattern::Binary:
             ret.score = float(double(mm.vali_min) / double(tsize.x * tsize.y));
@@ -374,11 +523,14 @@ IScreenMatcher::Result ScreenMatcher::match(std::span<ITemplatePtr> tmpls, HMONI
     auto i = m_screens.find(target);
     if (i != m_screens.end()) {
         auto& sd = i->second;
-        updateScreen(sd);
+        mrGfxLockScope();
+        std::unique_lock l(sd->mutex);
+        updateScreen(*sd, sd->info.rect, getRequiredStages(tmpls));
         for (auto& t : tmpls)
-            matchImpl(cast(*t), sd, sd.info.rect);
+            matchImpl(cast(*t), *sd, sd->info.rect);
+        return reduceResults(tmpls);
     }
-    return reduceResults(tmpls);
+    return {};
 }
 
 IScreenMatcher::Result ScreenMatcher::match(std::span<ITemplatePtr> tmpls, HWND target)
@@ -386,12 +538,31 @@ IScreenMatcher::Result ScreenMatcher::match(std::span<ITemplatePtr> tmpls, HWND
     auto i = m_screens.find(::MonitorFromWindow(target, MONITOR_DEFAULTTONULL));
     if (i != m_screens.end()) {
         auto& sd = i->second;
-        updateScreen(sd);
         auto rect = GetRect(target);
+        mrGfxLockScope();
+        std::unique_lock l(sd->mutex);
+        updateScreen(*sd, rect, getRequiredStages(tmpls));
+        for (auto& t : tmpls)
+            matchImpl(cast(*t), *sd, rect);
+        return reduceResults(tmpls);
+    }
+    return {};
+}
+
+IScreenMatcher::Result ScreenMatcher::match(std::span<ITemplatePtr> tmpls, Rect region)
+{
+    RECT r{ region.pos.x, region.pos.y, region.pos.x + region.size.x, region.pos.y + region.size.y };
+    auto i = m_screens.find(::MonitorFromRect(&r, MONITOR_DEFAULTTONULL));
+    if (i != m_screens.end()) {
+        auto& sd = i->second;
+        mrGfxLockScope();
+        std::unique_lock l(sd->mutex);
+        updateScreen(*sd, region, getRequiredStages(tmpls));
         for (auto& t : tmpls)
-            matchImpl(cast(*t), sd, rect);
+            matchImpl(cast(*t), *sd, region);
+        return reduceResults(tmpls);
     }
-    return reduceResults(tmpls);
+    return {};
 }
 
 
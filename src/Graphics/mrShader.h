@@ -49,6 +49,7 @@ public:
 
 private:
     ComputeShader m_cs;
+    ComputeShader m_cs_binary;
 };
 
 
@@ -3,170 +3,456 @@
 
 namespace mr {
 
+// indexed by OpType
+static const std::string_view g_op_names[] = {
+    "Unknown",
+    "KeyDown",
+    "KeyUp",
+    "MouseDown",
+    "MouseUp",
+    "MouseMoveAbs",
+    "MouseMoveRel",
+    "SaveMousePos",
+    "LoadMousePos",
+    "MatchParams",
+    "MouseMoveMatch",
+    "Wait",
+    "WaitUntilMatch",
+    "TimeShift",
+    "Repeat",
+};
+static_assert(std::size(g_op_names) == size_t(OpType::Repeat) + 1);
+
+const char* GetOpName(OpType v)
+{
+    if ((size_t)v >= std::size(g_op_names))
+        v = OpType::Unknown;
+    return g_op_names[(int)v].data();
+}
+
+static const std::string_view g_match_pattern_names[] = {
+    "BinaryContour",
+    "Binary",
+    "Grayscale",
+};
+
+static std::string_view GetMatchPatternName(ITemplate::MatchPattern v)
+{
+    switch (v) {
+    case ITemplate::MatchPattern::BinaryContour: return g_match_pattern_names[0];
+    case ITemplate::MatchPattern::Binary: return g_match_pattern_names[1];
+    case ITemplate::MatchPattern::Grayscale: return g_match_pattern_names[2];
+    default: return {};
+    }
+}
+
+static void AppendInt(std::string& dst, int64_t v)
+{
+    char buf[24];
+    auto r = std::to_chars(buf, std::end(buf), v);
+    dst.append(buf, r.ptr);
+}
+
+// same as "%.2f"
+static void AppendFloat(std::string& dst, float v)
+{
+    char buf[64];
+    auto r = std::to_chars(buf, std::end(buf), v, std::chars_format::fixed, 2);
+    dst.append(buf, r.ptr);
+}
+
 std::string OpRecord::toText() const
 {
-    auto templates_to_string = [this]() {
-        std::string ret;
-        ret += Format(" Threshold:%.2f", exdata.match_threshold);
-        switch (exdata.match_pattern) {
-        case ITemplate::MatchPattern::BinaryContour:
-            ret += " Pattern:\"BinaryContour\"";
-            break;
-        case ITemplate::MatchPattern::Binary:
-            ret += " Pattern:\"Binary\"";
-            break;
-        case ITemplate::MatchPattern::Grayscale:
-            ret += " Pattern:\"Grayscale\"";
-            break;
-        default:
-            break;
-        }
+    std::string ret;
+    toText(ret);
+    return ret;
+}
 
-        for (auto& id : exdata.templates)
-            ret += Format(" Template:\"%s\"", id.path.c_str());
-        return ret;
-    };
+void OpRecord::toText(std::string& dst) const
+{
+    if (type == OpType::Unknown || type > OpType::Repeat)
+        return;
 
+    if (type == OpType::MatchParams) {
+        auto& p = exdata.match_params;
+        dst += "MatchParams";
+        dst += " Scale:"; AppendFloat(dst, p.scale);
+        dst += " CareDisplayScale:"; dst += p.care_display_scale ? "true" : "false";
+        dst += " ColorRange:{"; AppendFloat(dst, p.color_range.x); dst += ','; AppendFloat(dst, p.color_range.y); dst += '}';
+        dst += " ContourRadius:"; AppendFloat(dst, p.contour_radius);
+        dst += " ExpandRadius:"; AppendFloat(dst, p.expand_radius);
+        dst += " BinarizeThreshold:"; AppendFloat(dst, p.binarize_threshold);
+        return;
+    }
+
+    AppendInt(dst, time);
+    dst += ": ";
+    dst += g_op_names[(int)type];
     switch (type)
     {
     case OpType::KeyDown:
-        return Format("%u: KeyDown %d", time, data.key.code);
-
     case OpType::KeyUp:
-        return Format("%u: KeyUp %d", time, data.key.code);
+        dst += ' '; AppendInt(dst, data.key.code);
+        break;
 
     case OpType::MouseDown:
-        return Format("%u: MouseDown %d", time, data.mouse.button);
-
     case OpType::MouseUp:
-        return Format("%u: MouseUp %d", time, data.mouse.button);
+        dst += ' '; AppendInt(dst, data.mouse.button);
+        break;
 
     case OpType::MouseMoveAbs:
-        return Format("%u: MouseMoveAbs %d %d", time, data.mouse.pos.x, data.mouse.pos.y);
-
     case OpType::MouseMoveRel:
-        return Format("%u: MouseMoveRel %d %d", time, data.mouse.pos.x, data.mouse.pos.y);
+        dst += ' '; AppendInt(dst, data.mouse.pos.x);
+        dst += ' '; AppendInt(dst, data.mouse.pos.y);
+        break;
 
     case OpType::SaveMousePos:
-        return Format("%u: SaveMousePos %d", time, exdata.save_slot);
-
     case OpType::LoadMousePos:
-        return Format("%u: LoadMousePos %d", time, exdata.save_slot);
-
-    case OpType::MatchParams:
-    {
-        std::string ret;
-        auto& p = exdata.match_params;
-        ret += "MatchParams";
-        ret += Format(" Scale:%.2f", p.scale);
-        ret += Format(" CareDisplayScale:%s", p.care_display_scale ? "true" : "false");
-        ret += Format(" ColorRange:{%.2f,%.2f}", p.color_range.x, p.color_range.y);
-        ret += Format(" ContourRadius:%.2f", p.contour_radius);
-        ret += Format(" ExpandRadius:%.2f", p.expand_radius);
-        ret += Format(" BinarizeThreshold:%.2f", p.binarize_threshold);
-        return ret;
-    }
+        dst += ' '; AppendInt(dst, exdata.save_slot);
+        break;
 
     case OpType::MouseMoveMatch:
-        return Format("%u: MouseMoveMatch") + templates_to_string();
-
     case OpType::WaitUntilMatch:
-        return Format("%u: WaitUntilMatch") + templates_to_string();
+    {
+        dst += " Threshold:"; AppendFloat(dst, exdata.match_threshold);
+        auto pattern = GetMatchPatternName(exdata.match_pattern);
+        if (!pattern.empty()) {
+            dst += " Pattern:\""; dst += pattern; dst += '"';
+        }
+        for (auto& id : exdata.templates) {
+            dst += " Template:\""; dst += id.path; dst += '"';
+        }
+        break;
+    }
 
     case OpType::Wait:
-        return Format("%u: Wait %d", time, exdata.wait_time);
+        dst += ' '; AppendInt(dst, exdata.wait_time);
+        break;
 
     case OpType::TimeShift:
-        return Format("%u: TimeShift %d", time, exdata.time_shift);
+        dst += ' '; AppendInt(dst, exdata.time_shift);
+        break;
 
     case OpType::Repeat:
-        return Format("%u: Repeat %d", time, exdata.repeat_point);
+        dst += ' '; AppendInt(dst, exdata.repeat_point);
+        break;
 
     default:
-        return "";
+        break;
     }
 }
 
-bool OpRecord::fromText(const std::string& v)
+
+// reads a line of the replay text format in place
+class OpTextReader
+{
+public:
+    std::string_view s;
+
+    void skipSpaces()
+    {
+        while (!s.empty() && IsSpaceChar(s.front()))
+            s.remove_prefix(1);
+    }
+
+    bool eat(char c)
+    {
+        skipSpaces();
+        if (s.empty() || s.front() != c)
+            return false;
+        s.remove_prefix(1);
+        return true;
+    }
+
+    std::string_view word()
+    {
+        skipSpaces();
+        size_t n = 0;
+        while (n < s.size() && IsWordChar(s[n]))
+            ++n;
+        auto ret = s.substr(0, n);
+        s.remove_prefix(n);
+        return ret;
+    }
+
+    template<class T>
+    bool number(T& dst)
+    {
+        skipSpaces();
+        if (!s.empty() && s.front() == '+')
+            s.remove_prefix(1);
+        auto r = std::from_chars(s.data(), s.data() + s.size(), dst);
+        if (r.ec != std::errc())
+            return false;
+        s.remove_prefix(r.ptr - s.data());
+        return true;
+    }
+};
+
+template<class T>
+static T ParseValue(std::string_view v)
+{
+    OpTextReader r{ v };
+    T ret{};
+    r.number(ret);
+    return ret;
+}
+
+template<>
+bool ParseValue(std::string_view v)
+{
+    if (v == "true")
+        return true;
+    else if (v == "false")
+        return false;
+    return ParseValue<int>(v) != 0;
+}
+
+template<>
+float2 ParseValue(std::string_view v)
+{
+    OpTextReader r{ v };
+    float2 ret{};
+    if (r.number(ret.x) && r.eat(',') && r.number(ret.y))
+        return ret;
+    return float2{};
+}
+
+static std::string_view Unquote(std::string_view v)
+{
+    if (v.size() >= 2 && v.front() == '"' && v.back() == '"')
+        return v.substr(1, v.size() - 2);
+    return {};
+}
+
+bool OpRecord::fromText(std::string_view v)
 {
     type = OpType::Unknown;
     if (v.empty() || v.front() == '\r' || v.front() == '\n' || v.front() == '#')
         return false;
+    while (!v.empty() && IsSpaceChar(v.back()))
+        v.remove_suffix(1);
+
+    // "time: Op args...". MatchParams has no time.
+    OpTextReader r{ v };
+    bool has_time = r.number(time) && r.eat(':');
+    auto op_name = r.word();
+    auto op_it = std::find(std::begin(g_op_names) + 1, std::end(g_op_names), op_name);
+    if (op_it == std::end(g_op_names))
+        return false;
+    auto op = OpType(op_it - std::begin(g_op_names));
+    if (!has_time && op != OpType::MatchParams)
+        return false;
+
+    bool ok = false;
+    switch (op)
+    {
+    case OpType::KeyDown:
+    case OpType::KeyUp:
+        ok = r.number(data.key.code);
+        break;
+
+    case OpType::MouseDown:
+    case OpType::MouseUp:
+        ok = r.number(data.mouse.button);
+        break;
+
+    case OpType::MouseMoveAbs:
+    case OpType::MouseMoveRel:
+        ok = r.number(data.mouse.pos.x) && r.number(data.mouse.pos.y);
+        break;
 
-    const char* src = v.c_str();
+    case OpType::SaveMousePos:
+    case OpType::LoadMousePos:
+        ok = r.number(exdata.save_slot);
+        break;
+
+    case OpType::MatchParams:
+    {
+        auto& p = exdata.match_params;
+        ForEachKVP(r.s, [&p](std::string_view k, std::string_view v) {
+            if (k == "Scale")
+                p.scale = ParseValue<float>(v);
+            else if (k == "CareDisplayScale")
+                p.care_display_scale = ParseValue<bool>(v);
+            else if (k == "ColorRange")
+                p.color_range = ParseValue<float2>(v);
+            else if (k == "ContourRadius")
+                p.contour_radius = ParseValue<float>(v);
+            else if (k == "ExpandRadius")
+                p.expand_radius = ParseValue<float>(v);
+            else if (k == "BinarizeThreshold")
+                p.binarize_threshold = ParseValue<float>(v);
+            });
+        ok = true;
+        break;
+    }
 
-    auto scan_templates = [this, &src]() {
-        ScanKVP(src, [this](std::string k, std::string v) {
+    case OpType::MouseMoveMatch:
+    case OpType::WaitUntilMatch:
+        ForEachKVP(r.s, [this](std::string_view k, std::string_view v) {
             if (k == "Threshold") {
-                exdata.match_threshold = ToValue<float>(v);
+                exdata.match_threshold = ParseValue<float>(v);
             }
             else if (k == "Pattern") {
-                auto p = ToValue<std::string>(v);
-                if (p == "BinaryContour")
+                auto p = Unquote(v);
+                if (p == g_match_pattern_names[0])
                     exdata.match_pattern = ITemplate::MatchPattern::BinaryContour;
-                else if (p == "Binary")
+                else if (p == g_match_pattern_names[1])
                     exdata.match_pattern = ITemplate::MatchPattern::Binary;
-                else if (p == "Grayscale")
+                else if (p == g_match_pattern_names[2])
                     exdata.match_pattern = ITemplate::MatchPattern::Grayscale;
             }
             else if (k == "Template") {
-                exdata.templates.push_back({ ToValue<std::string>(v) });
+                exdata.templates.push_back({ std::string(Unquote(v)) });
             }
             });
-    };
+        ok = true;
+        break;
 
-    if (sscanf(src, "%u: KeyDown %d", &time, &data.key.code) == 2)
-        type = OpType::KeyDown;
-    else if (sscanf(src, "%u: KeyUp %d", &time, &data.key.code) == 2)
-        type = OpType::KeyUp;
-    else if (sscanf(src, "%u: MouseDown %d", &time, &data.mouse.button) == 2)
-        type = OpType::MouseDown;
-    else if (sscanf(src, "%u: MouseUp %d", &time, &data.mouse.button) == 2)
-        type = OpType::MouseUp;
-    else if (sscanf(src, "%u: MouseMoveAbs %d %d", &time, &data.mouse.pos.x, &data.mouse.pos.y) == 3)
-        type = OpType::MouseMoveAbs;
-    else if (sscanf(src, "%u: MouseMoveRel %d %d", &time, &data.mouse.pos.x, &data.mouse.pos.y) == 3)
-        type = OpType::MouseMoveRel;
-    else if (sscanf(src, "%u: SaveMousePos %d", &time, &exdata.save_slot) == 2)
-        type = OpType::SaveMousePos;
-    else if (sscanf(src, "%u: LoadMousePos %d", &time, &exdata.save_slot) == 2)
-        type = OpType::LoadMousePos;
-    else if (std::strstr(src, "MatchParams ")) {
-        type = OpType::MatchParams;
-        ScanKVP(src, [this](std::string k, std::string v) {
-            auto& p = exdata.match_params;
-            if (k == "Scale")
-                p.scale = ToValue<float>(v);
-            else if (k == "CareDisplayScale")
-                p.care_display_scale = ToValue<bool>(v);
-            else if (k == "ColorRange")
-                p.color_range = ToValue<float2>(v);
-            else if (k == "ContourRadius")
-                p.contour_radius = ToValue<float>(v);
-            else if (k == "ExpandRadius")
-                p.expand_radius = ToValue<float>(v);
-            else if (k == "BinarizeThreshold")
-                p.binarize_threshold = ToValue<float>(v);
-            });
+    case OpType::Wait:
+        ok = r.number(exdata.wait_time);
+        break;
+
+    case OpType::TimeShift:
+        ok = r.number(exdata.time_shift);
+        break;
+
+    case OpType::Repeat:
+        ok = r.number(exdata.repeat_point);
+        break;
+
+    default:
+        break;
+    }
+
+    if (ok)
+        type = op;
+    return ok;
+}
+
+
+MousePathSimplifier::MousePathSimplifier(const EmitHandler& emit)
+    : m_emit(emit)
+{
+}
+
+void MousePathSimplifier::setParams(const Params& v)
+{
+    flush();
+    m_params = v;
+}
+
+const MousePathSimplifier::Params& MousePathSimplifier::getParams() const
+{
+    return m_params;
+}
+
+// distance between p and where the played cursor is at p.time, while Player moves it from a to b.
+// see Player::interpolateMousePath().
+static float GetPlaybackError(const OpRecord& a, const OpRecord& b, const OpRecord& p)
+{
+    int2 pos = b.data.mouse.pos;
+    if (p.time < b.time) {
+        float t = float(p.time - a.time) / float(b.time - a.time);
+        pos = int2(round(lerp(float2(a.data.mouse.pos), float2(b.data.mouse.pos), t)));
     }
-    else if (std::strstr(src, "MouseMoveMatch") && sscanf(src, "%u: ", &time) == 1) {
-        type = OpType::MouseMoveMatch;
-        scan_templates();
+    return length(float2(p.data.mouse.pos - pos));
+}
+
+void MousePathSimplifier::push(const OpRecord& rec)
+{
+    ++m_input_count;
+    if (rec.type != OpType::MouseMoveAbs || m_params.spatial <= 0.0f) {
+        flush();
+        emit(rec);
+        if (rec.type != OpType::MouseMoveAbs)
+            m_anchor.reset(); // the next move starts a new path
+        return;
     }
-    else if (std::strstr(src, "WaitUntilMatch") && sscanf(src, "%u: ", &time) == 1) {
-        type = OpType::WaitUntilMatch;
-        scan_templates();
+
+    if (!m_anchor) {
+        emit(rec); // start of a path is always kept
+        return;
     }
-    else if (sscanf(src, "%u: Wait %d", &time, &exdata.wait_time) == 2)
-        type = OpType::Wait;
-    else if (sscanf(src, "%u: TimeShift %d", &time, &exdata.time_shift) == 2)
-        type = OpType::TimeShift;
-    else if (sscanf(src, "%u: Repeat %d", &time, &exdata.repeat_point) == 2)
-        type = OpType::Repeat;
+    m_pending.push_back(rec);
+    if ((int)m_pending.size() >= m_params.max_window)
+        flush();
+}
 
-    return type != OpType::Unknown;
+void MousePathSimplifier::flush()
+{
+    if (!m_pending.empty())
+        simplify();
 }
 
+// Ramer-Douglas-Peucker on the anchor and the pending points. the last pending point is always kept and becomes the next anchor.
+// segments longer than temporal are split at temporal even if they are within the error bound.
+void MousePathSimplifier::simplify()
+{
+    // index 0 is the anchor
+    auto point = [this](size_t i) -> const OpRecord& { return i == 0 ? *m_anchor : m_pending[i - 1]; };
+    size_t n = m_pending.size() + 1;
+    std::vector<bool> keep(n, false);
+    keep[n - 1] = true;
+
+    std::vector<std::pair<size_t, size_t>> ranges{ { 0, n - 1 } };
+    while (!ranges.empty()) {
+        auto [first, last] = ranges.back();
+        ranges.pop_back();
+        if (last - first < 2)
+            continue;
+
+        auto& a = point(first);
+        auto& b = point(last);
+        size_t split = first;
+        float max_error = 0.0f;
+        for (size_t i = first + 1; i < last; ++i) {
+            float e = GetPlaybackError(a, b, point(i));
+            if (e > max_error) {
+                max_error = e;
+                split = i;
+            }
+        }
+        if (max_error <= m_params.spatial) {
+            if (millisec(b.time - a.time) <= m_params.temporal)
+                continue;
+            // the farthest point within temporal from a
+            split = first + 1;
+            while (split + 1 < last && millisec(point(split + 1).time - a.time) <= m_params.temporal)
+                ++split;
+        }
+        keep[split] = true;
+        ranges.push_back({ first, split });
+        ranges.push_back({ split, last });
+    }
+
+    for (size_t i = 1; i < n; ++i) {
+        if (keep[i])
+            emit(m_pending[i - 1]);
+    }
+    m_pending.clear();
+}
+
+void MousePathSimplifier::emit(const OpRecord& rec)
+{
+    if (rec.type == OpType::MouseMoveAbs)
+        m_anchor = rec;
+    ++m_output_count;
+    m_emit(rec);
+}
+
+size_t MousePathSimplifier::getInputCount() const
+{
+    return m_input_count;
+}
+
+size_t MousePathSimplifier::getOutputCount() const
+{
+    return m_output_count;
+}
+
+
 std::map<Key, std::string> LoadKeymap(const char* path, const std::function<void(Key key, std::string path)>& body)
 {
     std::map<Key, std::string> ret;
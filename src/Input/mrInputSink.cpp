@@ -0,0 +1,157 @@
+#include "pch.h"
+#include "mrInternal.h"
+
+namespace mr {
+
+class SendInputSink : public RefCount<IInputSink>
+{
+public:
+    void emit(std::span<const InputEvent> events) override;
+
+private:
+    std::vector<INPUT> m_inputs;
+};
+
+void SendInputSink::emit(std::span<const InputEvent> events)
+{
+    if (events.empty())
+        return;
+
+    // http://msdn.microsoft.com/en-us/library/ms646260(VS.85).aspx
+    // If MOUSEEVENTF_ABSOLUTE value is specified, dx and dy contain normalized absolute coordinates between 0 and 65,535.
+    // The event procedure maps these coordinates onto the display surface.
+    // Coordinate (0,0) maps onto the upper-left corner of the display surface, (65535,65535) maps onto the lower-right corner.
+    // queried every batch because the resolution may change while playing.
+    float2 s2c = 65535.0f / float2{
+        float(::GetSystemMetrics(SM_CXSCREEN)),
+        float(::GetSystemMetrics(SM_CYSCREEN))
+    };
+
+    m_inputs.clear();
+    for (auto& e : events) {
+        INPUT input{};
+        switch (e.type) {
+        case InputEvent::Type::MouseMove:
+        {
+            int2 cpos = int2(float2(e.pos) * s2c);
+            input.type = INPUT_MOUSE;
+            input.mi.dx = cpos.x;
+            input.mi.dy = cpos.y;
+            input.mi.dwFlags = MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE;
+            break;
+        }
+        case InputEvent::Type::MouseDown:
+            input.type = INPUT_MOUSE;
+            switch (e.code) {
+            case 1: input.mi.dwFlags = MOUSEEVENTF_LEFTDOWN; break;
+            case 2: input.mi.dwFlags = MOUSEEVENTF_RIGHTDOWN; break;
+            case 3: input.mi.dwFlags = MOUSEEVENTF_MIDDLEDOWN; break;
+            default: break;
+            }
+            break;
+        case InputEvent::Type::MouseUp:
+            input.type = INPUT_MOUSE;
+            switch (e.code) {
+            case 1: input.mi.dwFlags = MOUSEEVENTF_LEFTUP; break;
+            case 2: input.mi.dwFlags = MOUSEEVENTF_RIGHTUP; break;
+            case 3: input.mi.dwFlags = MOUSEEVENTF_MIDDLEUP; break;
+            default: break;
+            }
+            break;
+        case InputEvent::Type::KeyDown:
+        case InputEvent::Type::KeyUp:
+            input.type = INPUT_KEYBOARD;
+            input.ki.wVk = (WORD)e.code;
+            if (e.type == InputEvent::Type::KeyUp)
+                input.ki.dwFlags |= KEYEVENTF_KEYUP;
+            break;
+        default:
+            continue;
+        }
+        m_inputs.push_back(input);
+    }
+    if (!m_inputs.empty())
+        ::SendInput((UINT)m_inputs.size(), m_inputs.data(), sizeof(INPUT));
+}
+
+mrAPI IInputSink* CreateSendInputSink_()
+{
+    return new SendInputSink();
+}
+
+
+// no platform dependency. emit() may be called from the playback thread while the test thread reads.
+class VirtualInputSink : public RefCount<IVirtualInputSink>
+{
+public:
+    VirtualInputSink(size_t capacity);
+    void emit(std::span<const InputEvent> events) override;
+    size_t getCount() const override;
+    size_t getTotalCount() const override;
+    size_t getBatchCount() const override;
+    std::vector<Record> getRecords() const override;
+    void clear() override;
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<Record> m_ring;
+    size_t m_total = 0; // next write position is m_total % capacity
+    uint32_t m_batch = 0;
+};
+
+VirtualInputSink::VirtualInputSink(size_t capacity)
+{
+    m_ring.resize(std::max<size_t>(capacity, 1));
+}
+
+void VirtualInputSink::emit(std::span<const InputEvent> events)
+{
+    nanosec now = NowNS();
+    std::unique_lock l(m_mutex);
+    for (auto& e : events)
+        m_ring[m_total++ % m_ring.size()] = { e, now, m_batch };
+    ++m_batch;
+}
+
+size_t VirtualInputSink::getCount() const
+{
+    std::unique_lock l(m_mutex);
+    return std::min(m_total, m_ring.size());
+}
+
+size_t VirtualInputSink::getTotalCount() const
+{
+    std::unique_lock l(m_mutex);
+    return m_total;
+}
+
+size_t VirtualInputSink::getBatchCount() const
+{
+    std::unique_lock l(m_mutex);
+    return m_batch;
+}
+
+std::vector<IVirtualInputSink::Record> VirtualInputSink::getRecords() const
+{
+    std::unique_lock l(m_mutex);
+    size_t n = std::min(m_total, m_ring.size());
+    std::vector<Record> ret;
+    ret.reserve(n);
+    for (size_t i = m_total - n; i < m_total; ++i)
+        ret.push_back(m_ring[i % m_ring.size()]);
+    return ret;
+}
+
+void VirtualInputSink::clear()
+{
+    std::unique_lock l(m_mutex);
+    m_total = 0;
+    m_batch = 0;
+}
+
+mrAPI IVirtualInputSink* CreateVirtualInputSink_(size_t capacity)
+{
+    return new VirtualInputSink(capacity);
+}
+
+} // namespace mr
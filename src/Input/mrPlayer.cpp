@@ -1,8 +1,113 @@
 #include "pch.h"
 #include "mrInternal.h"
+#include "mrReplayFile.h"
 
 namespace mr {
 
+// runs screen matching on a worker thread so that the playback thread never stalls on it.
+// requests are processed in order. each player has its own worker, so workers of other players (keymaps) may be matching
+// at the same time. ScreenMatcher serializes them with the gfx lock.
+class MatchWorker
+{
+public:
+    using Result = IScreenMatcher::Result;
+    using Callback = std::function<void()>;
+
+    // on_complete is called on the worker thread each time a result becomes ready.
+    MatchWorker(const Callback& on_complete);
+    ~MatchWorker();
+    MatchWorker(const MatchWorker&) = delete;
+
+    std::future<Result> match(IScreenMatcherPtr smatch, ReplayMatchPtr match, HWND target);
+    std::future<Result> match(IScreenMatcherPtr smatch, ReplayMatchPtr match, Rect region);
+
+private:
+    struct Request
+    {
+        IScreenMatcherPtr smatch;
+        ReplayMatchPtr match;
+        HWND target{}; // if null, search only in region
+        Rect region{};
+        std::promise<Result> result;
+    };
+
+    std::future<Result> push(Request&& req);
+    void workerThread();
+
+    Callback m_on_complete;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Request> m_queue;
+    std::thread m_thread;
+    bool m_closing = false;
+};
+
+MatchWorker::MatchWorker(const Callback& on_complete)
+    : m_on_complete(on_complete)
+{
+}
+
+MatchWorker::~MatchWorker()
+{
+    {
+        std::unique_lock l(m_mutex);
+        m_closing = true;
+    }
+    m_cond.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+std::future<MatchWorker::Result> MatchWorker::match(IScreenMatcherPtr smatch, ReplayMatchPtr match, HWND target)
+{
+    return push(Request{ smatch, std::move(match), target });
+}
+
+std::future<MatchWorker::Result> MatchWorker::match(IScreenMatcherPtr smatch, ReplayMatchPtr match, Rect region)
+{
+    return push(Request{ smatch, std::move(match), nullptr, region });
+}
+
+std::future<MatchWorker::Result> MatchWorker::push(Request&& req)
+{
+    auto ret = req.result.get_future();
+    {
+        std::unique_lock l(m_mutex);
+        // thread is spawned on first use
+        if (!m_thread.joinable())
+            m_thread = std::thread([this]() { workerThread(); });
+        m_queue.push_back(std::move(req));
+    }
+    m_cond.notify_one();
+    return ret;
+}
+
+void MatchWorker::workerThread()
+{
+    for (;;) {
+        Request req;
+        {
+            std::unique_lock l(m_mutex);
+            m_cond.wait(l, [this]() { return m_closing || !m_queue.empty(); });
+            if (m_queue.empty())
+                break;
+            req = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        Result r;
+        if (req.smatch && req.match && req.target)
+            r = req.smatch->match(req.match->templates, req.target);
+        else if (req.smatch && req.match)
+            r = req.smatch->match(req.match->templates, req.region);
+        mrDbgPrint("match score: %.2f (%d, %d)\n", r.score, r.region.getCenter().x, r.region.getCenter().y);
+        req.result.set_value(std::move(r));
+        if (m_on_complete)
+            m_on_complete();
+    }
+}
+
+
 class Player : public RefCount<IPlayer>
 {
 public:
@@ -14,53 +119,145 @@ public:
     bool update() override;
     bool load(const char* path) override;
     void setMatchTarget(MatchTarget v) override;
-
-    bool execRecord(const OpRecord& rec);
+    void setInputSink(IInputSinkPtr v) override;
 
 private:
-    bool m_playing = false;
-    millisec m_time_start_real = 0;
-    millisec m_time_start = 0;
-    millisec m_time_wait = 0;
-    uint32_t m_record_index = 0;
+    // the program is either all in m_program or streamed from m_stream
+    uint32_t getInstructionCount() const;
+    const Instruction& getInstruction(uint32_t i);
+    const ReplayMatchPtr& getMatch(uint32_t i);
+    uint32_t getJumpTarget(const Instruction& inst);
+    uint32_t findNextMouseMoveMatch(uint32_t i);
+    ITemplatePtr loadTemplate(const std::string& path);
+    void loadTemplates(OpRecord& rec);
+
+    void playbackThread();
+    nanosec processInstructions();
+    bool execInstruction(const Instruction& inst);
+    void pushEvent(InputEvent::Type type, int2 pos = {}, int code = 0);
+    void flushEvents();
+    nanosec interpolateMousePath(const Instruction& inst, nanosec deadline, nanosec now);
+    nanosec prefetchMatch(nanosec now);
+    void bindMatch(uint32_t index);
+    void requestMatch();
+    void usePrefetchedMatch();
+    bool isMatchReady() const;
+    bool dependsOnMatch(const Instruction& inst) const;
+    bool resolveMouseMoveMatch();
+
+    static const uint32_t kNoInstruction = ~0u;
+
+    std::atomic_bool m_playing{ false };
+    nanosec m_time_start_real = 0;
+    nanosec m_time_start = 0;
+    nanosec m_time_wait = 0;
+    uint32_t m_pc = 0; // index of the instruction to execute next
     uint32_t m_loop_required = 0, m_loop_count = 0;
-    std::vector<OpRecord> m_records;
+    ReplayProgram m_program;
 
     struct State
     {
         int2 mouse_pos{};
     };
     State m_state;
-    std::map<int, State> m_mouse_state_slots;
+    std::vector<std::optional<State>> m_slots; // indexed by Instruction::slot
+
+    // start of the segment the cursor follows until the next MouseMoveAbs.
+    // valid only while the last executed instruction is MouseMoveAbs.
+    bool m_path_valid = false;
+    int2 m_path_pos{};
+    nanosec m_path_time = 0;
 
     MatchTarget m_match_target = MatchTarget::EntireScreen;
     IScreenMatcherPtr m_smatch;
+
+    // events are queued by instructions and emitted once per tick
+    IInputSinkPtr m_sink;
+    IInputSinkPtr m_sink_default;
+    std::vector<InputEvent> m_events;
+    nanosec m_exec_time = 0; // scheduled time of the instruction being executed
+
+    std::thread m_thread;
+    DeadlineTimer m_timer;
+
+    // in-flight match. m_match is the operands of the MouseMoveMatch or WaitUntilMatch that requested it,
+    // held here as a streamed chunk may be dropped meanwhile. m_match_op and m_match_index are its op and index.
+    // the worker is declared after m_timer because it wakes m_timer until it is destroyed.
+    MatchWorker m_match_worker;
+    std::future<MatchWorker::Result> m_match_result;
+    ReplayMatchPtr m_match;
+    OpType m_match_op = OpType::Unknown;
+    uint32_t m_match_index = 0;
+    bool m_match_blocked = false;
+    bool m_match_revalidating = false;
+    // match started ahead of a MouseMoveMatch. m_prefetch_index is the index of the instruction.
+    std::future<MatchWorker::Result> m_prefetch_result;
+    uint32_t m_prefetch_index = kNoInstruction;
+
+    // holds the templates of the replay, created by m_smatch
+    std::unique_ptr<ReplayStream> m_stream;
 };
 
+static inline nanosec MS2NS(int64_t v) { return nanosec(v * 1000000); }
+
+// re-check interval while blocked on a match. the worker wakes the playback thread on completion, so this is just a safety net.
+static const nanosec kMatchPollInterval = MS2NS(10);
+// MouseMoveMatch starts matching this much before its deadline
+static const nanosec kMatchLookahead = MS2NS(200);
+// margin around the prefetched result when re-checking it (screen pixels)
+static const int kRevalidateMargin = 8;
+// step of the cursor between consecutive MouseMoveAbs. record times are in millisec, so finer steps make no difference.
+static const nanosec kMouseInterpolationInterval = MS2NS(1);
+static const nanosec kNever = ~nanosec(0);
 
 Player::Player()
+    : m_match_worker([this]() { m_timer.wake(); })
 {
 }
 
 Player::~Player()
 {
+    stop();
+    if (m_thread.joinable())
+        m_thread.join();
 }
 
 bool Player::start(uint32_t loop)
 {
-    if (m_playing || m_records.empty())
+    if (m_playing || getInstructionCount() == 0)
         return false;
-
-    m_time_start_real = m_time_start = NowMS();
+    // previous playback may have stopped by itself
+    if (m_thread.joinable())
+        m_thread.join();
+
+    m_time_start_real = m_time_start = NowNS();
+    m_time_wait = 0;
+    m_match_result = {};
+    m_match.reset();
+    m_match_blocked = false;
+    m_match_revalidating = false;
+    m_prefetch_result = {};
+    m_prefetch_index = kNoInstruction;
+    m_path_valid = false;
     m_loop_required = loop;
     m_loop_count = 0;
-    m_record_index = 0;
-    m_playing = true;
+    m_pc = 0;
 
     CURSORINFO ci;
     ci.cbSize = sizeof(ci);
     ::GetCursorInfo(&ci);
     m_state.mouse_pos = (int2&)ci.ptScreenPos;
+
+    if (!m_sink) {
+        if (!m_sink_default)
+            m_sink_default = CreateSendInputSink();
+        m_sink = m_sink_default;
+    }
+    m_events.clear();
+
+    m_timer.reset();
+    m_playing = true;
+    m_thread = std::thread([this]() { playbackThread(); });
     return true;
 }
 
@@ -70,6 +267,10 @@ bool Player::stop()
         return false;
 
     m_playing = false;
+    m_timer.cancel();
+    // stop() can be called from the playback thread (e.g. match failure)
+    if (m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+        m_thread.join();
     return true;
 }
 
@@ -80,187 +281,313 @@ bool Player::isPlaying() const
 
 bool Player::update()
 {
-    if (!m_playing || m_records.empty())
+    // playback is done in playbackThread(). just reap the thread if it has finished.
+    if (!m_playing) {
+        if (m_thread.joinable())
+            m_thread.join();
         return false;
+    }
+    return true;
+}
 
+void Player::playbackThread()
+{
+    // input timing matters more than anything else on this thread
+    ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
 
-    // execute records
-    for (;;) {
-        const auto& rec = m_records[m_record_index];
-
-        millisec time_before_exec = NowMS();
-        millisec time_rec = time_before_exec - m_time_start;
-
-        if (time_rec >= rec.time) {
-            auto go_next = execRecord(rec);
+    while (m_playing) {
+        nanosec deadline = processInstructions();
+        flushEvents();
+        if (!m_playing || !m_timer.waitUntil(deadline))
+            break;
+    }
+}
 
-            millisec time_after_exec = NowMS();
-            millisec timestamp = time_after_exec - m_time_start_real;
-            millisec elapsed = time_after_exec - time_before_exec;
-            if (!go_next) {
-                m_time_start = time_after_exec - rec.time;
-                break;
+// executes instructions whose deadline has come and returns the deadline of the next one.
+// the timeline is advanced by instruction times, not by when they actually got executed, so lateness doesn't accumulate.
+nanosec Player::processInstructions()
+{
+    for (;;) {
+        const auto& inst = getInstruction(m_pc);
+
+        nanosec deadline = m_time_start + MS2NS(inst.time);
+        nanosec time_before_exec = NowNS();
+        if (time_before_exec < deadline) {
+            nanosec next = std::min(deadline, prefetchMatch(time_before_exec));
+            if (m_path_valid && inst.op == OpType::MouseMoveAbs)
+                next = std::min(next, interpolateMousePath(inst, deadline, time_before_exec));
+            return next;
+        }
+        m_exec_time = deadline;
+
+        if (m_match && m_match_op == OpType::MouseMoveMatch && dependsOnMatch(inst)) {
+            // this instruction needs the mouse position from the pending MouseMoveMatch.
+            // other instructions keep their timing while the match is in flight.
+            if (!isMatchReady() || !resolveMouseMoveMatch()) {
+                m_match_blocked = true;
+                return time_before_exec + kMatchPollInterval;
             }
-            else if (!m_playing) {
-                break;
+            if (!m_playing)
+                return NowNS();
+            if (m_match_blocked) {
+                // hold the timeline for the time blocked
+                m_match_blocked = false;
+                time_before_exec = NowNS();
+                m_time_start = time_before_exec - MS2NS(inst.time);
+                deadline = m_exec_time = time_before_exec;
             }
+        }
 
-            mrDbgPrint("record executed (%ld %ld ms): %s\n", timestamp, elapsed, rec.toText().c_str());
-            ++m_record_index;
+        auto go_next = execInstruction(inst);
+        m_path_valid = go_next && inst.op == OpType::MouseMoveAbs;
+        if (m_path_valid) {
+            m_path_pos = inst.pos;
+            m_path_time = deadline;
+        }
 
-            if (rec.type == OpType::MouseMoveMatch) {
-                // adjust time if MouseMoveMatch because it is very slow and causes input hiccup
-                m_time_start += elapsed;
-            }
-            else if (rec.type == OpType::TimeShift) {
-                // handle time shift
-                m_time_start = time_after_exec - rec.time + rec.exdata.time_shift;
-            }
-            else if (rec.type == OpType::Repeat) {
-                // rewind time and record index
-                m_time_start = NowMS() - rec.exdata.repeat_point;
+        nanosec time_after_exec = NowNS();
+        if (!go_next) {
+            // Wait & WaitUntilMatch: hold the timeline until it completes
+            m_time_start = time_after_exec - MS2NS(inst.time);
+            if (inst.op == OpType::Wait)
+                return m_time_wait + MS2NS(inst.value);
+            else if (inst.op == OpType::WaitUntilMatch)
+                return time_after_exec + kMatchPollInterval;
+            return time_after_exec;
+        }
+        else if (!m_playing) {
+            return time_after_exec;
+        }
 
-                auto it = std::lower_bound(m_records.begin(), m_records.end(), rec.exdata.repeat_point,
-                    [](const OpRecord& r, int t) { return r.time < t; });
-                m_record_index = (uint32_t)std::distance(m_records.begin(), it);
-                break;
-            }
+        mrDbgPrint("instruction executed (%.2f ms, late %.3f ms, took %.3f ms): #%u %s\n",
+            double(time_after_exec - m_time_start_real) / 1000000.0,
+            double(time_before_exec - deadline) / 1000000.0,
+            double(time_after_exec - time_before_exec) / 1000000.0,
+            m_pc, GetOpName(inst.op));
+        ++m_pc;
 
-            if (m_record_index >= m_records.size()) {
-                // go next loop or stop
-                m_record_index = 0;
-                m_time_start = NowMS();
-                ++m_loop_count;
-                if (m_loop_count >= m_loop_required) {
-                    m_playing = false;
-                    return false;
-                }
-                else {
-                    break;
-                }
-            }
+        if (inst.op == OpType::TimeShift) {
+            // handle time shift
+            m_time_start += MS2NS(inst.value);
         }
-        else {
-            break;
+        else if (inst.op == OpType::Repeat) {
+            // rewind time and jump. inst may be gone once getJumpTarget() reads another chunk.
+            m_time_start = deadline - MS2NS(inst.value);
+            m_pc = getJumpTarget(inst);
+        }
+
+        if (m_pc >= getInstructionCount()) {
+            // go next loop or stop
+            m_pc = 0;
+            m_time_start = deadline;
+            m_path_valid = false;
+            ++m_loop_count;
+            if (m_loop_count >= m_loop_required) {
+                m_playing = false;
+                return time_after_exec;
+            }
         }
     }
-    return true;
 }
 
-bool Player::execRecord(const OpRecord& rec)
+void Player::pushEvent(InputEvent::Type type, int2 pos, int code)
 {
-    auto send = [](INPUT& v) {
-        ::SendInput(1, &v, sizeof(INPUT));
-    };
+    m_events.push_back({ type, pos, code, m_exec_time });
+}
 
-    auto make_mouse_move = [](INPUT& input, int2 screen_pos) {
-        // http://msdn.microsoft.com/en-us/library/ms646260(VS.85).aspx
-        // If MOUSEEVENTF_ABSOLUTE value is specified, dx and dy contain normalized absolute coordinates between 0 and 65,535.
-        // The event procedure maps these coordinates onto the display surface.
-        // Coordinate (0,0) maps onto the upper-left corner of the display surface, (65535,65535) maps onto the lower-right corner.
-
-        static float2 s2c = 65535.0f / float2{
-            float(::GetSystemMetrics(SM_CXSCREEN)),
-            float(::GetSystemMetrics(SM_CYSCREEN))
-        };
-        int2 cpos = int2(float2(screen_pos) * s2c);
-        input.mi.dx = cpos.x;
-        input.mi.dy = cpos.y;
-        input.mi.dwFlags = MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE;
-    };
+void Player::flushEvents()
+{
+    if (m_events.empty())
+        return;
+    m_sink->emit(m_events);
+    m_events.clear();
+}
 
-    auto do_match = [this, &rec]() {
-        std::vector<ITemplatePtr> templates;
-        for (auto& i : rec.exdata.templates)
-            if (i.tmpl)
-                templates.push_back(i.tmpl);
+// moves the cursor along the segment from the last MouseMoveAbs to inst, which is due at deadline.
+// MousePathSimplifier drops points that are close enough to these segments. returns when this wants to be called again.
+nanosec Player::interpolateMousePath(const Instruction& inst, nanosec deadline, nanosec now)
+{
+    nanosec duration = deadline - m_path_time;
+    if (duration <= kMouseInterpolationInterval)
+        return kNever;
+
+    float t = float(double(now - m_path_time) / double(duration));
+    int2 pos = int2(round(lerp(float2(m_path_pos), float2(inst.pos), t)));
+    if (pos != m_state.mouse_pos) {
+        m_state.mouse_pos = pos;
+        m_exec_time = now; // not scheduled by an instruction. the event is due now
+        pushEvent(InputEvent::Type::MouseMove, pos);
+    }
+    // steps are aligned to the record times, where MousePathSimplifier measures the error
+    return m_path_time + ((now - m_path_time) / kMouseInterpolationInterval + 1) * kMouseInterpolationInterval;
+}
 
-        auto match_target = ::GetForegroundWindow();
-        auto r = m_smatch->match(templates, match_target);
-        mrDbgPrint("match score: %.2f (%d, %d)\n", r.score, r.region.getCenter().x, r.region.getCenter().y);
-        return r;
-    };
+// starts matching for the upcoming MouseMoveMatch kMatchLookahead before its deadline,
+// so that the match latency overlaps with the wait before it. returns when this wants to be called again.
+nanosec Player::prefetchMatch(nanosec now)
+{
+    uint32_t i = findNextMouseMoveMatch(m_pc);
+    if (i >= getInstructionCount() || i == m_prefetch_index || (m_match && i == m_match_index))
+        return kNever;
+
+    nanosec start = m_time_start + MS2NS(getInstruction(i).time) - kMatchLookahead;
+    if (now < start)
+        return start;
+
+    m_prefetch_result = m_match_worker.match(m_smatch, getMatch(i), ::GetForegroundWindow());
+    m_prefetch_index = i;
+    return kNever;
+}
+
+// makes the match instruction at index the in-flight one
+void Player::bindMatch(uint32_t index)
+{
+    m_match = getMatch(index);
+    m_match_op = getInstruction(index).op;
+    m_match_index = index;
+}
+
+void Player::requestMatch()
+{
+    auto match_target = ::GetForegroundWindow();
+    m_match_result = m_match_worker.match(m_smatch, m_match, match_target);
+    m_match_revalidating = false;
+}
+
+// for the MouseMoveMatch at m_pc
+void Player::usePrefetchedMatch()
+{
+    auto result = std::move(m_prefetch_result);
+    m_prefetch_index = kNoInstruction;
+    bindMatch(m_pc);
+
+    if (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        // still in flight. take it as is. its frame is at most kMatchLookahead old.
+        m_match_result = std::move(result);
+        m_match_revalidating = false;
+        return;
+    }
+
+    auto r = result.get();
+    if (r.score <= m_match->threshold) {
+        // re-check only around the found position on the latest frame
+        m_match_result = m_match_worker.match(m_smatch, m_match, r.region.expand(kRevalidateMargin));
+        m_match_revalidating = true;
+    }
+    else {
+        // the screen may have changed since then
+        requestMatch();
+    }
+}
+
+bool Player::isMatchReady() const
+{
+    return m_match_result.valid() && m_match_result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+bool Player::dependsOnMatch(const Instruction& inst) const
+{
+    // anything that reads or writes the mouse position, and matches themselves to keep them in order
+    switch (inst.op) {
+    case OpType::MouseDown:
+    case OpType::MouseUp:
+    case OpType::MouseMoveAbs:
+    case OpType::MouseMoveRel:
+    case OpType::MouseMoveMatch:
+    case OpType::SaveMousePos:
+    case OpType::LoadMousePos:
+    case OpType::WaitUntilMatch:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// returns false if the match has to be retried. the retry is already requested then.
+bool Player::resolveMouseMoveMatch()
+{
+    auto r = m_match_result.get();
+    float threshold = m_match->threshold;
+    if (r.score > threshold && m_match_revalidating) {
+        // the target moved since the prefetch. fall back to the full search.
+        requestMatch();
+        return false;
+    }
+    m_match.reset();
+
+    if (r.score <= threshold) {
+        m_state.mouse_pos = r.region.getCenter();
+        pushEvent(InputEvent::Type::MouseMove, m_state.mouse_pos);
+    }
+    else {
+        stop();
+    }
+    return true;
+}
 
+// inst is the instruction at m_pc
+bool Player::execInstruction(const Instruction& inst)
+{
     bool ret = true;
-    switch (rec.type)
+    switch (inst.op)
     {
     case OpType::MouseDown:
     {
-        INPUT input{ INPUT_MOUSE };
-        switch (rec.data.mouse.button) {
-        case 1: input.mi.dwFlags |= MOUSEEVENTF_LEFTDOWN; break;
-        case 2: input.mi.dwFlags |= MOUSEEVENTF_RIGHTDOWN; break;
-        case 3: input.mi.dwFlags |= MOUSEEVENTF_MIDDLEDOWN; break;
-        default: break;
-        }
-        send(input);
+        pushEvent(InputEvent::Type::MouseDown, {}, inst.code);
         break;
     }
 
     case OpType::MouseUp:
     {
-        INPUT input{ INPUT_MOUSE };
-        switch (rec.data.mouse.button) {
-        case 1: input.mi.dwFlags |= MOUSEEVENTF_LEFTUP; break;
-        case 2: input.mi.dwFlags |= MOUSEEVENTF_RIGHTUP; break;
-        case 3: input.mi.dwFlags |= MOUSEEVENTF_MIDDLEUP; break;
-        default: break;
-        }
-        send(input);
+        pushEvent(InputEvent::Type::MouseUp, {}, inst.code);
         break;
     }
 
     case OpType::MouseMoveAbs:
     {
-        INPUT input{ INPUT_MOUSE };
-        m_state.mouse_pos = rec.data.mouse.pos;
-        make_mouse_move(input, m_state.mouse_pos);
-        send(input);
+        m_state.mouse_pos = inst.pos;
+        pushEvent(InputEvent::Type::MouseMove, m_state.mouse_pos);
         break;
     }
 
     case OpType::MouseMoveRel:
     {
-        INPUT input{ INPUT_MOUSE };
-        m_state.mouse_pos += rec.data.mouse.pos;
-        make_mouse_move(input, m_state.mouse_pos);
-        send(input);
+        m_state.mouse_pos += inst.pos;
+        pushEvent(InputEvent::Type::MouseMove, m_state.mouse_pos);
         break;
     }
 
     case OpType::MouseMoveMatch:
     {
-        INPUT input{ INPUT_MOUSE };
-        auto r = do_match();
-        if (r.score <= rec.exdata.match_threshold) {
-            m_state.mouse_pos = r.region.getCenter();
-            make_mouse_move(input, m_state.mouse_pos);
-            send(input);
+        // the result is applied by resolveMouseMoveMatch() before the next instruction that depends on it
+        if (m_prefetch_index == m_pc) {
+            usePrefetchedMatch();
         }
         else {
-            stop();
+            bindMatch(m_pc);
+            requestMatch();
         }
         break;
     }
 
     case OpType::SaveMousePos:
     {
-        m_mouse_state_slots[rec.exdata.save_slot] = m_state;
+        // streamed programs may find new slots while playing
+        if (inst.slot >= m_slots.size())
+            m_slots.resize(inst.slot + 1);
+        m_slots[inst.slot] = m_state;
         break;
     }
     case OpType::LoadMousePos:
     {
-        auto i = m_mouse_state_slots.find(rec.exdata.save_slot);
-        if (i != m_mouse_state_slots.end()) {
-            m_state = i->second;
-
-            INPUT input{};
-            input.type = INPUT_MOUSE;
-            make_mouse_move(input, m_state.mouse_pos);
-
-            // it seems single mouse move can't step over display boundary. so SendInput twice.
-            send(input);
-            send(input);
+        if (inst.slot < m_slots.size() && m_slots[inst.slot]) {
+            m_state = *m_slots[inst.slot];
+
+            // it seems single mouse move can't step over display boundary. so move twice.
+            // the moves must be separate SendInput() calls, so the first one is emitted on its own.
+            pushEvent(InputEvent::Type::MouseMove, m_state.mouse_pos);
+            flushEvents();
+            pushEvent(InputEvent::Type::MouseMove, m_state.mouse_pos);
         }
         break;
     }
@@ -268,20 +595,16 @@ bool Player::execRecord(const OpRecord& rec)
     case OpType::KeyDown:
     case OpType::KeyUp:
     {
-        INPUT input{ INPUT_KEYBOARD };
-        input.ki.wVk = (WORD)rec.data.key.code;
-        if (rec.type == OpType::KeyUp)
-            input.ki.dwFlags |= KEYEVENTF_KEYUP;
-        send(input);
+        pushEvent(inst.op == OpType::KeyDown ? InputEvent::Type::KeyDown : InputEvent::Type::KeyUp, {}, inst.code);
         break;
     }
 
     case OpType::Wait:
     {
         if (m_time_wait == 0)
-            m_time_wait = NowMS();
+            m_time_wait = NowNS();
 
-        if ((NowMS() - m_time_wait) >= rec.exdata.wait_time) {
+        if ((NowNS() - m_time_wait) >= MS2NS(inst.value)) {
             m_time_wait = 0;
         }
         else {
@@ -292,14 +615,27 @@ bool Player::execRecord(const OpRecord& rec)
 
     case OpType::WaitUntilMatch:
     {
-        auto r = do_match();
-        if (r.score <= rec.exdata.match_threshold) {
-            // ok
+        if (!m_match || m_match_index != m_pc) {
+            bindMatch(m_pc);
+            requestMatch();
+            ret = false;
         }
-        else {
-            WaitVSync();
+        else if (!isMatchReady()) {
             ret = false;
         }
+        else {
+            auto r = m_match_result.get();
+            if (r.score > m_match->threshold) {
+                // retry next frame. don't hold events of this tick while waiting.
+                flushEvents();
+                WaitVSync();
+                requestMatch();
+                ret = false;
+            }
+            else {
+                m_match.reset();
+            }
+        }
         break;
     }
 
@@ -311,42 +647,92 @@ bool Player::execRecord(const OpRecord& rec)
 
 bool Player::load(const char* path)
 {
-    m_records.clear();
+    m_stream.reset();
+    m_program.clear();
+    m_slots.clear();
+
+    // indexed binary replays are streamed. records are decoded and compiled chunk by chunk while playing.
+    auto stream = std::make_unique<ReplayStream>();
+    if (stream->open(path)) {
+        // only the first MatchParams (in the header) is applied. later ones would be ahead of the decoded records.
+        if (auto mp = stream->getMatchParams())
+            m_smatch = CreateScreenMatcher(mp->exdata.match_params);
+        else if (!m_smatch)
+            m_smatch = CreateScreenMatcher();
+        // templates are loaded here once. chunks are re-decoded on seeks and Repeat, so loading them on decode would repeat it.
+        stream->loadTemplates([this](const std::string& path) { return loadTemplate(path); });
+        m_stream = std::move(stream);
+        return m_stream->size() > 0;
+    }
 
-    std::ifstream ifs(path, std::ios::in);
-    if (!ifs)
+    std::vector<OpRecord> records;
+    if (!LoadReplay(path, records))
         return false;
 
-    std::string l;
-    while (std::getline(ifs, l)) {
-        OpRecord rec;
-        if (rec.fromText(l)) {
-            if (rec.type == OpType::MatchParams) {
-                m_smatch = CreateScreenMatcher(rec.exdata.match_params);
-            }
-
-            if (!rec.exdata.templates.empty()) {
-                if (!m_smatch)
-                    m_smatch = CreateScreenMatcher();
-
-                for (auto& id : rec.exdata.templates) {
-                    id.tmpl = m_smatch->createTemplate(id.path.c_str());
-                    if (id.tmpl) {
-                        id.tmpl->setMatchPattern(rec.exdata.match_pattern);
-                    }
-                    else {
-                        mrDbgPrint("*** failed to load template %s ***\n", id.path.c_str());
-                    }
-                }
-            }
+    for (auto& rec : records) {
+        if (rec.type == OpType::MatchParams) {
+            m_smatch = CreateScreenMatcher(rec.exdata.match_params);
+        }
 
-            m_records.push_back(rec);
+        if (!rec.exdata.templates.empty()) {
+            if (!m_smatch)
+                m_smatch = CreateScreenMatcher();
+            loadTemplates(rec);
         }
     }
-    std::stable_sort(m_records.begin(), m_records.end(),
+    std::stable_sort(records.begin(), records.end(),
         [](auto& a, auto& b) { return a.time < b.time; });
 
-    return !m_records.empty();
+    // records are not needed once compiled
+    ReplayCompiler compiler;
+    compiler.compile(records, m_program, true);
+    m_slots.resize(compiler.getSlotCount());
+    return !m_program.code.empty();
+}
+
+ITemplatePtr Player::loadTemplate(const std::string& path)
+{
+    auto ret = m_smatch ? m_smatch->createTemplate(path.c_str()) : nullptr;
+    if (!ret)
+        mrDbgPrint("*** failed to load template %s ***\n", path.c_str());
+    return ret;
+}
+
+void Player::loadTemplates(OpRecord& rec)
+{
+    for (auto& id : rec.exdata.templates) {
+        id.tmpl = loadTemplate(id.path);
+        if (id.tmpl)
+            id.tmpl->setMatchPattern(rec.exdata.match_pattern);
+    }
+}
+
+uint32_t Player::getInstructionCount() const
+{
+    return m_stream ? m_stream->size() : (uint32_t)m_program.code.size();
+}
+
+const Instruction& Player::getInstruction(uint32_t i)
+{
+    return m_stream ? m_stream->at(i) : m_program.code[i];
+}
+
+const ReplayMatchPtr& Player::getMatch(uint32_t i)
+{
+    return m_stream ? m_stream->getMatch(i) : m_program.matches[m_program.code[i].match];
+}
+
+uint32_t Player::getJumpTarget(const Instruction& inst)
+{
+    // jumps in streamed programs are resolved through the time index
+    if (inst.target == Instruction::kUnresolved && m_stream)
+        return m_stream->lowerBound((uint32_t)std::max(inst.value, 0));
+    return inst.target;
+}
+
+uint32_t Player::findNextMouseMoveMatch(uint32_t i)
+{
+    return m_stream ? m_stream->findNextMouseMoveMatch(i) : m_program.next_mmatch[i];
 }
 
 void Player::setMatchTarget(MatchTarget v)
@@ -354,6 +740,13 @@ void Player::setMatchTarget(MatchTarget v)
     m_match_target = v;
 }
 
+void Player::setInputSink(IInputSinkPtr v)
+{
+    if (m_playing)
+        return;
+    m_sink = v;
+}
+
 mrAPI IPlayer* CreatePlayer_()
 {
     return new Player();
@@ -14,8 +14,13 @@ public:
     bool save(const char* path) const override;
 
     void addRecord(const OpRecord& rec) override;
+    void setRecordFrames(bool v) override;
+    void setMousePathTolerance(float spatial, millisec temporal) override;
 
     // internal
+    void frameCaptureThread();
+    void storeRecord(const OpRecord& rec);
+    void removeArchive();
 
 private:
     bool m_recording = false;
@@ -23,11 +28,29 @@ private:
     int m_handle = 0;
 
     std::vector<OpRecord> m_records;
+    MousePathSimplifier m_simplifier{ [this](const OpRecord& rec) { storeRecord(rec); } };
+
+    // frame recording
+    bool m_record_frames = false;
+    std::atomic_bool m_capturing_frames{ false };
+    nanosec m_time_start_ns = 0;
+    std::thread m_frame_thread;
+    std::string m_archive_path;
 };
 
 Recorder::~Recorder()
 {
     stop();
+    removeArchive();
+}
+
+void Recorder::removeArchive()
+{
+    if (!m_archive_path.empty()) {
+        std::error_code ec;
+        std::filesystem::remove(m_archive_path, ec);
+        m_archive_path.clear();
+    }
 }
 
 bool Recorder::start()
@@ -47,7 +70,17 @@ bool Recorder::start()
         });
 
     m_time_start = NowMS();
+    m_time_start_ns = NowNS();
     m_recording = true;
+
+    // frames of the previous recording are discarded with it
+    removeArchive();
+    if (m_record_frames) {
+        // frames are captured and compressed on other threads so that input recording never waits for them.
+        m_archive_path = (std::filesystem::temp_directory_path() / Format("mrFrames_%llu.mrfa", m_time_start_ns)).string();
+        m_capturing_frames = true;
+        m_frame_thread = std::thread([this]() { frameCaptureThread(); });
+    }
     return true;
 }
 
@@ -58,11 +91,16 @@ bool Recorder::stop()
         mr::OpRecord rec;
         rec.type = mr::OpType::Wait;
         addRecord(rec);
+        mrDbgPrint("mouse path simplified: %d -> %d records\n", (int)m_simplifier.getInputCount(), (int)m_simplifier.getOutputCount());
     }
     if (m_handle) {
         GetReceiver()->removeRecorder(m_handle);
         m_handle = 0;
     }
+    if (m_frame_thread.joinable()) {
+        m_capturing_frames = false;
+        m_frame_thread.join();
+    }
     return true;
 }
 
@@ -76,7 +114,82 @@ bool Recorder::update()
     return m_handle != 0;
 }
 
+void Recorder::frameCaptureThread()
+{
+    auto gfx = GetGfxInterface();
+    auto capture = gfx->createScreenCapture();
+    if (!capture || !capture->startCapture(GetPrimaryMonitor()))
+        return;
+
+    IFrameArchiveWriterPtr writer;
+    int2 archive_size{};
+    uint64_t last_frame = 0;
+    while (m_capturing_frames) {
+        // poll instead of waitNextFrame(). no frames arrive while the screen is static and stop() must not hang.
+        auto frame = capture->getFrame();
+        if (!frame.surface || frame.present_time == last_frame) {
+            WaitVSync();
+            continue;
+        }
+        last_frame = frame.present_time;
+
+        if (!writer) {
+            writer = CreateFrameArchiveWriter(m_archive_path.c_str(), frame.size.x, frame.size.y, frame.surface->getFormat());
+            if (!writer)
+                break;
+            archive_size = frame.size;
+        }
+        auto surface_size = frame.surface->getSize();
+        if (surface_size.x < archive_size.x || surface_size.y < archive_size.y)
+            continue; // display mode changed. the archive keeps its initial size
+
+        // nanosec on the replay timeline. NowMS() and NowNS() share the clock, so time / 1000000 matches OpRecord::time.
+        uint64_t time = NowNS() - m_time_start * 1000000;
+
+        // only the copy to staging and map / unmap are done under the gfx lock. waiting for the GPU and
+        // copying pixels to the writer happen outside of it, so match workers are not stalled by the readback.
+        gfx->lock([&]() { frame.surface->download(); });
+        const void* data = nullptr;
+        int pitch = 0;
+        bool mapped = false;
+        while (m_capturing_frames) {
+            gfx->lock([&]() { mapped = frame.surface->map(data, pitch, false); });
+            if (mapped)
+                break;
+            std::this_thread::yield();
+        }
+        if (mapped) {
+            writer->addFrame(data, pitch, time);
+            gfx->lock([&]() { frame.surface->unmap(); });
+        }
+    }
+    capture->stopCapture();
+
+    if (writer) {
+        writer->close();
+        mrDbgPrint("frame archive: %d frames, %d dropped\n", writer->getFrameCount(), writer->getDroppedFrameCount());
+    }
+}
+
+void Recorder::setRecordFrames(bool v)
+{
+    m_record_frames = v;
+}
+
+void Recorder::setMousePathTolerance(float spatial, millisec temporal)
+{
+    auto params = m_simplifier.getParams();
+    params.spatial = spatial;
+    params.temporal = temporal;
+    m_simplifier.setParams(params);
+}
+
 void Recorder::addRecord(const OpRecord& rec)
+{
+    m_simplifier.push(rec);
+}
+
+void Recorder::storeRecord(const OpRecord& rec)
 {
     m_records.push_back(rec);
     mrDbgPrint("record added: %s\n", rec.toText().c_str());
@@ -84,12 +197,26 @@ void Recorder::addRecord(const OpRecord& rec)
 
 bool Recorder::save(const char* path) const
 {
-    std::ofstream ofs(path, std::ios::out);
-    if (!ofs)
+    if (!SaveReplay(path, m_records))
         return false;
 
-    for (auto& rec : m_records)
-        ofs << rec.toText() << std::endl;
+    if (!m_archive_path.empty()) {
+        if (m_frame_thread.joinable()) {
+            // the archive is incomplete until stop()
+            mrDbgPrint("*** Recorder::save(): still recording. frame archive is not saved ***\n");
+            return true;
+        }
+        // copy the frame archive next to the replay. the temporary archive is kept so that save() can be called again
+        // (e.g. "save as"), and is removed when the next recording starts or the recorder is destroyed.
+        namespace fs = std::filesystem;
+        auto dst = fs::path(path).replace_extension(".mrfa");
+        std::error_code ec;
+        if (fs::exists(m_archive_path, ec)) {
+            fs::copy_file(m_archive_path, dst, fs::copy_options::overwrite_existing, ec);
+            if (ec)
+                mrDbgPrint("*** Recorder::save(): failed to copy frame archive to %s ***\n", dst.string().c_str());
+        }
+    }
     return true;
 }
 
@@ -0,0 +1,756 @@
+#include "pch.h"
+#include "mrInternal.h"
+#include "mrReplayFile.h"
+
+namespace mr {
+
+// binary replay layout:
+//   ReplayHeader
+//   record stream (at header.records_offset)
+//   string table (at header.strings_offset): string_count x { varint length, chars }
+//   time index (at header.index_offset): index_count x ReplayIndexEntry. version 2 or later
+//
+// each record in the stream is:
+//   uint8 type, zig-zag varint delta of time from the previous record, then payload by type:
+//   - KeyDown/KeyUp, MouseDown/MouseUp: varint code / button
+//   - MouseMoveAbs: zig-zag varint delta of position from the previous MouseMoveAbs
+//   - MouseMoveRel: zig-zag varint x, y
+//   - SaveMousePos/LoadMousePos, Wait, TimeShift, Repeat: zig-zag varint value
+//   - MouseMoveMatch/WaitUntilMatch: float threshold, uint8 pattern, varint template count, varint string indices
+//   - MatchParams: MatchParamsBlock
+// the first MatchParams is held in the header instead, with its position in the record sequence.
+//
+// the time index has an entry per index_interval records, with the decoder state at that record.
+// it allows decoding from the middle of the stream and is written only if records are sorted by time.
+
+static const char g_replay_magic[4] = { 'M', 'R', 'R', 'P' };
+static const uint32_t g_replay_version = 2;
+static const uint32_t g_replay_index_interval = 1024;
+static const uint32_t g_no_match_params = ~0u;
+static const size_t g_match_pattern_count = 3; // number of ITemplate::MatchPattern values
+
+struct MatchParamsBlock
+{
+    float scale{};
+    float color_range[2]{};
+    float contour_radius{};
+    float expand_radius{};
+    float binarize_threshold{};
+    uint32_t care_display_scale{};
+    uint32_t time{};
+};
+static_assert(sizeof(MatchParamsBlock) == 32);
+
+struct ReplayHeader
+{
+    char magic[4]{};
+    uint32_t version{};
+    uint32_t record_count{};
+    uint32_t string_count{};
+    uint64_t records_offset{};
+    uint64_t records_size{};
+    uint64_t strings_offset{};
+    uint32_t match_params_index{}; // g_no_match_params if none
+    uint32_t pad{};
+    MatchParamsBlock match_params{};
+    uint64_t index_offset{};
+    uint32_t index_count{}; // 0 if no index
+    uint32_t index_interval{};
+};
+static_assert(sizeof(ReplayHeader) == 96);
+
+struct ReplayIndexEntry
+{
+    uint64_t offset{};    // from records_offset
+    uint32_t time{};      // time of the first record of the chunk
+    uint32_t prev_time{}; // time of the previous record. base of the time delta
+    int32_t abs_pos[2]{}; // position of the previous MouseMoveAbs. base of the position delta
+};
+static_assert(sizeof(ReplayIndexEntry) == 24);
+
+static MatchParamsBlock ToBlock(const OpRecord& rec)
+{
+    auto& p = rec.exdata.match_params;
+    MatchParamsBlock ret;
+    ret.scale = p.scale;
+    ret.color_range[0] = p.color_range.x;
+    ret.color_range[1] = p.color_range.y;
+    ret.contour_radius = p.contour_radius;
+    ret.expand_radius = p.expand_radius;
+    ret.binarize_threshold = p.binarize_threshold;
+    ret.care_display_scale = p.care_display_scale ? 1 : 0;
+    ret.time = rec.time;
+    return ret;
+}
+
+static OpRecord FromBlock(const MatchParamsBlock& b)
+{
+    OpRecord ret;
+    ret.type = OpType::MatchParams;
+    ret.time = b.time;
+    auto& p = ret.exdata.match_params;
+    p.scale = b.scale;
+    p.color_range = { b.color_range[0], b.color_range[1] };
+    p.contour_radius = b.contour_radius;
+    p.expand_radius = b.expand_radius;
+    p.binarize_threshold = b.binarize_threshold;
+    p.care_display_scale = b.care_display_scale != 0;
+    return ret;
+}
+
+
+class ReplayEncoder
+{
+public:
+    std::vector<byte> buf;
+
+    void putByte(uint32_t v) { buf.push_back((byte)v); }
+    void putVarint(uint64_t v)
+    {
+        while (v >= 0x80) {
+            buf.push_back(byte(v | 0x80));
+            v >>= 7;
+        }
+        buf.push_back(byte(v));
+    }
+    void putSigned(int64_t v) { putVarint(uint64_t(v << 1) ^ uint64_t(v >> 63)); } // zig-zag
+    template<class T> void putRaw(const T& v)
+    {
+        auto p = (const byte*)&v;
+        buf.insert(buf.end(), p, p + sizeof(T));
+    }
+};
+
+class ReplayDecoder
+{
+public:
+    const byte* pos = nullptr;
+    const byte* end = nullptr;
+    bool ok = true;
+
+    uint32_t getByte()
+    {
+        if (pos >= end) {
+            ok = false;
+            return 0;
+        }
+        return *pos++;
+    }
+    uint64_t getVarint()
+    {
+        uint64_t ret = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint32_t b = getByte();
+            ret |= uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0)
+                return ret;
+        }
+        ok = false;
+        return 0;
+    }
+    int64_t getSigned()
+    {
+        uint64_t v = getVarint();
+        return int64_t(v >> 1) ^ -int64_t(v & 1);
+    }
+    template<class T> T getRaw()
+    {
+        T ret{};
+        if (end - pos < (ptrdiff_t)sizeof(T)) {
+            ok = false;
+            return ret;
+        }
+        memcpy(&ret, pos, sizeof(T));
+        pos += sizeof(T);
+        return ret;
+    }
+};
+
+
+static bool IsBinaryReplay(const byte* data, size_t size)
+{
+    return size >= sizeof(ReplayHeader) && memcmp(data, g_replay_magic, 4) == 0;
+}
+
+// offsets and counts come from the file. compare them without overflow, and bound the counts by the bytes they need
+// (a record takes at least 1 byte, a string at least its length), so they can be used to reserve memory.
+// the index must have exactly one entry per index_interval records, as chunks are located by it.
+static bool IsValidHeader(const ReplayHeader& header, size_t size)
+{
+    if (header.version < 1 || header.version > g_replay_version ||
+        header.records_offset > size || header.records_size > size - header.records_offset ||
+        header.record_count > header.records_size ||
+        header.strings_offset > size || header.string_count > size - header.strings_offset)
+        return false;
+    if (header.version >= 2 && header.index_count > 0) {
+        if (header.index_interval == 0 || header.index_offset % alignof(ReplayIndexEntry) != 0 ||
+            header.index_offset > size || header.index_count > (size - header.index_offset) / sizeof(ReplayIndexEntry) ||
+            uint64_t(header.index_count - 1) * header.index_interval >= header.record_count ||
+            uint64_t(header.index_count) * header.index_interval < header.record_count)
+            return false;
+    }
+    return true;
+}
+
+static bool LoadStrings(const byte* data, size_t size, const ReplayHeader& header, std::vector<std::string>& dst)
+{
+    dst.resize(header.string_count);
+    ReplayDecoder dec{ data + header.strings_offset, data + size };
+    for (auto& s : dst) {
+        size_t len = (size_t)dec.getVarint();
+        if (!dec.ok || size_t(dec.end - dec.pos) < len)
+            return false;
+        s.assign((const char*)dec.pos, len);
+        dec.pos += len;
+    }
+    return true;
+}
+
+// time and abs_pos are the decoder state, updated by the record.
+// templates are loaded templates indexed by string index * g_match_pattern_count + match pattern. empty if not loaded.
+static bool DecodeRecord(ReplayDecoder& dec, int64_t& time, int2& abs_pos, const std::vector<std::string>& strings, OpRecord& rec,
+    std::span<const ITemplatePtr> templates = {})
+{
+    rec.type = (OpType)dec.getByte();
+    time += dec.getSigned();
+    rec.time = (uint32_t)time;
+    switch (rec.type) {
+    case OpType::KeyDown:
+    case OpType::KeyUp:
+        rec.data.key.code = (int)dec.getVarint();
+        break;
+    case OpType::MouseDown:
+    case OpType::MouseUp:
+        rec.data.mouse.button = (int)dec.getVarint();
+        break;
+    case OpType::MouseMoveAbs:
+        abs_pos.x += (int)dec.getSigned();
+        abs_pos.y += (int)dec.getSigned();
+        rec.data.mouse.pos = abs_pos;
+        break;
+    case OpType::MouseMoveRel:
+        rec.data.mouse.pos.x = (int)dec.getSigned();
+        rec.data.mouse.pos.y = (int)dec.getSigned();
+        break;
+    case OpType::SaveMousePos:
+    case OpType::LoadMousePos:
+        rec.exdata.save_slot = (int)dec.getSigned();
+        break;
+    case OpType::Wait:
+        rec.exdata.wait_time = (int)dec.getSigned();
+        break;
+    case OpType::TimeShift:
+        rec.exdata.time_shift = (int)dec.getSigned();
+        break;
+    case OpType::Repeat:
+        rec.exdata.repeat_point = (int)dec.getSigned();
+        break;
+    case OpType::MouseMoveMatch:
+    case OpType::WaitUntilMatch:
+    {
+        rec.exdata.match_threshold = dec.getRaw<float>();
+        rec.exdata.match_pattern = (ITemplate::MatchPattern)dec.getByte();
+        size_t n = (size_t)dec.getVarint();
+        for (size_t i = 0; i < n && dec.ok; ++i) {
+            size_t si = (size_t)dec.getVarint();
+            if (si >= strings.size()) {
+                dec.ok = false;
+                break;
+            }
+            size_t ti = si * g_match_pattern_count + (size_t)rec.exdata.match_pattern;
+            bool loaded = (size_t)rec.exdata.match_pattern < g_match_pattern_count && ti < templates.size();
+            rec.exdata.templates.push_back({ strings[si], loaded ? templates[ti] : ITemplatePtr() });
+        }
+        break;
+    }
+    case OpType::MatchParams:
+    {
+        auto t = rec.time;
+        rec = FromBlock(dec.getRaw<MatchParamsBlock>());
+        rec.time = t;
+        break;
+    }
+    default:
+        dec.ok = false;
+        break;
+    }
+    return dec.ok;
+}
+
+static bool LoadReplayBinary(const byte* data, size_t size, std::vector<OpRecord>& dst)
+{
+    if (!IsBinaryReplay(data, size))
+        return false;
+    auto& header = *(const ReplayHeader*)data;
+    if (!IsValidHeader(header, size)) {
+        mrDbgPrint("*** LoadReplayBinary: invalid header ***\n");
+        return false;
+    }
+
+    std::vector<std::string> strings;
+    if (!LoadStrings(data, size, header, strings))
+        return false;
+
+    dst.reserve(dst.size() + header.record_count);
+    ReplayDecoder dec{ data + header.records_offset, data + header.records_offset + header.records_size };
+    int64_t time = 0;
+    int2 abs_pos{};
+    for (uint32_t ri = 0; ri < header.record_count && dec.ok; ++ri) {
+        if (ri == header.match_params_index)
+            dst.push_back(FromBlock(header.match_params));
+
+        OpRecord rec;
+        if (DecodeRecord(dec, time, abs_pos, strings, rec))
+            dst.push_back(std::move(rec));
+    }
+    if (header.match_params_index == header.record_count && dec.ok)
+        dst.push_back(FromBlock(header.match_params));
+
+    if (!dec.ok) {
+        mrDbgPrint("*** LoadReplayBinary: corrupted record stream ***\n");
+        return false;
+    }
+    return true;
+}
+
+mrAPI bool SaveReplayBinary(const char* path, std::span<const OpRecord> records)
+{
+    ReplayHeader header;
+    memcpy(header.magic, g_replay_magic, 4);
+    header.version = g_replay_version;
+    header.match_params_index = g_no_match_params;
+
+    std::vector<std::string> strings;
+    std::map<std::string, uint32_t> string_indices;
+    auto get_string_index = [&](const std::string& s) {
+        auto it = string_indices.find(s);
+        if (it != string_indices.end())
+            return it->second;
+        uint32_t ret = (uint32_t)strings.size();
+        strings.push_back(s);
+        string_indices[s] = ret;
+        return ret;
+    };
+
+    ReplayEncoder enc;
+    enc.buf.reserve(records.size() * 4);
+    std::vector<ReplayIndexEntry> index;
+    bool sorted = true;
+    int64_t time = 0;
+    int2 abs_pos{};
+    for (auto& rec : records) {
+        if (rec.type == OpType::MatchParams && header.match_params_index == g_no_match_params) {
+            header.match_params_index = header.record_count;
+            header.match_params = ToBlock(rec);
+            continue;
+        }
+        if (rec.type == OpType::Unknown)
+            continue;
+
+        if (header.record_count % g_replay_index_interval == 0)
+            index.push_back({ enc.buf.size(), rec.time, (uint32_t)time, { abs_pos.x, abs_pos.y } });
+        if (header.record_count > 0 && rec.time < time)
+            sorted = false;
+
+        enc.putByte((uint32_t)rec.type);
+        enc.putSigned(int64_t(rec.time) - time);
+        time = rec.time;
+        switch (rec.type) {
+        case OpType::KeyDown:
+        case OpType::KeyUp:
+            enc.putVarint((uint32_t)rec.data.key.code);
+            break;
+        case OpType::MouseDown:
+        case OpType::MouseUp:
+            enc.putVarint((uint32_t)rec.data.mouse.button);
+            break;
+        case OpType::MouseMoveAbs:
+            enc.putSigned(rec.data.mouse.pos.x - abs_pos.x);
+            enc.putSigned(rec.data.mouse.pos.y - abs_pos.y);
+            abs_pos = rec.data.mouse.pos;
+            break;
+        case OpType::MouseMoveRel:
+            enc.putSigned(rec.data.mouse.pos.x);
+            enc.putSigned(rec.data.mouse.pos.y);
+            break;
+        case OpType::SaveMousePos:
+        case OpType::LoadMousePos:
+            enc.putSigned(rec.exdata.save_slot);
+            break;
+        case OpType::Wait:
+            enc.putSigned(rec.exdata.wait_time);
+            break;
+        case OpType::TimeShift:
+            enc.putSigned(rec.exdata.time_shift);
+            break;
+        case OpType::Repeat:
+            enc.putSigned(rec.exdata.repeat_point);
+            break;
+        case OpType::MouseMoveMatch:
+        case OpType::WaitUntilMatch:
+            enc.putRaw(rec.exdata.match_threshold);
+            enc.putByte((uint32_t)rec.exdata.match_pattern);
+            enc.putVarint(rec.exdata.templates.size());
+            for (auto& t : rec.exdata.templates)
+                enc.putVarint(get_string_index(t.path));
+            break;
+        case OpType::MatchParams:
+            enc.putRaw(ToBlock(rec));
+            break;
+        default:
+            break;
+        }
+        ++header.record_count;
+    }
+
+    header.records_offset = sizeof(ReplayHeader);
+    header.records_size = enc.buf.size();
+    header.strings_offset = header.records_offset + header.records_size;
+    header.string_count = (uint32_t)strings.size();
+    for (auto& s : strings) {
+        enc.putVarint(s.size());
+        enc.buf.insert(enc.buf.end(), (const byte*)s.data(), (const byte*)s.data() + s.size());
+    }
+    if (sorted && !index.empty()) {
+        // entries are read in place from the mapped file
+        while ((header.records_offset + enc.buf.size()) % alignof(ReplayIndexEntry) != 0)
+            enc.putByte(0);
+        header.index_offset = header.records_offset + enc.buf.size();
+        header.index_count = (uint32_t)index.size();
+        header.index_interval = g_replay_index_interval;
+        for (auto& e : index)
+            enc.putRaw(e);
+    }
+
+    std::ofstream ofs(path, std::ios::out | std::ios::binary);
+    if (!ofs)
+        return false;
+    ofs.write((const char*)&header, sizeof(header));
+    ofs.write((const char*)enc.buf.data(), enc.buf.size());
+    return (bool)ofs;
+}
+
+mrAPI bool SaveReplayText(const char* path, std::span<const OpRecord> records)
+{
+    std::ofstream ofs(path, std::ios::out);
+    if (!ofs)
+        return false;
+
+    // records are formatted into a block and written when it fills up
+    const size_t block_size = 1024 * 1024;
+    std::string block;
+    block.reserve(block_size + 4096);
+    for (auto& rec : records) {
+        size_t pos = block.size();
+        rec.toText(block);
+        if (block.size() != pos)
+            block += '\n';
+        if (block.size() >= block_size) {
+            ofs.write(block.data(), block.size());
+            block.clear();
+        }
+    }
+    ofs.write(block.data(), block.size());
+    return (bool)ofs;
+}
+
+static bool IsBinaryReplayPath(const char* path)
+{
+    auto ext = std::filesystem::path(path).extension().string();
+    return ext == ".mrr" || ext == ".MRR";
+}
+
+mrAPI bool LoadReplay(const char* path, std::vector<OpRecord>& dst)
+{
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+
+    if (IsBinaryReplay(file.data(), file.size()))
+        return LoadReplayBinary(file.data(), file.size(), dst);
+
+    // text
+    auto s = (const char*)file.data();
+    auto end = s + file.size();
+    while (s < end) {
+        auto eol = (const char*)memchr(s, '\n', end - s);
+        if (!eol)
+            eol = end;
+        std::string_view line(s, eol - s);
+        s = eol + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1); // CRLF
+
+        OpRecord rec;
+        if (rec.fromText(line))
+            dst.push_back(std::move(rec));
+    }
+    return true;
+}
+
+mrAPI bool SaveReplay(const char* path, std::span<const OpRecord> records)
+{
+    return IsBinaryReplayPath(path) ? SaveReplayBinary(path, records) : SaveReplayText(path, records);
+}
+
+mrAPI bool ConvertReplay(const char* src_path, const char* dst_path)
+{
+    std::vector<OpRecord> records;
+    if (!LoadReplay(src_path, records))
+        return false;
+    return SaveReplay(dst_path, records);
+}
+
+
+ReplayStream::ReplayStream()
+{
+}
+
+ReplayStream::~ReplayStream()
+{
+    close();
+}
+
+bool ReplayStream::open(const char* path)
+{
+    close();
+    if (!m_file.open(path))
+        return false;
+
+    auto data = m_file.data();
+    auto size = m_file.size();
+    auto& header = *(const ReplayHeader*)data;
+    if (!IsBinaryReplay(data, size) || !IsValidHeader(header, size) || header.version < 2 || header.index_count == 0 ||
+        !LoadStrings(data, size, header, m_strings))
+    {
+        close();
+        return false;
+    }
+
+    m_header = &header;
+    m_index = (const ReplayIndexEntry*)(data + header.index_offset);
+    if (header.match_params_index != g_no_match_params)
+        m_match_params = FromBlock(header.match_params);
+    return true;
+}
+
+void ReplayStream::close()
+{
+    {
+        std::unique_lock l(m_mutex);
+        m_closing = true;
+    }
+    m_cond.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+
+    m_closing = false;
+    m_prefetch_id = kNoChunk;
+    m_prefetch_pending = false;
+    m_prefetched.reset();
+    m_cache.clear();
+    m_compiler.clear();
+    m_match_params.reset();
+    m_templates.clear();
+    m_strings.clear();
+    m_index = nullptr;
+    m_header = nullptr;
+    m_file.close();
+}
+
+void ReplayStream::loadTemplates(const TemplateLoader& loader)
+{
+    // one template for each match pattern, as a path can be used with different patterns. chunks are decoded on the
+    // prefetch thread while the match worker reads these, so their patterns are set here and never changed later.
+    m_templates.resize(m_strings.size() * g_match_pattern_count);
+    for (size_t si = 0; si < m_strings.size(); ++si) {
+        for (size_t pi = 0; pi < g_match_pattern_count; ++pi) {
+            auto t = loader(m_strings[si]);
+            if (!t)
+                break;
+            t->setMatchPattern((ITemplate::MatchPattern)pi);
+            m_templates[si * g_match_pattern_count + pi] = t;
+        }
+    }
+}
+
+uint32_t ReplayStream::size() const
+{
+    return m_header ? m_header->record_count : 0;
+}
+
+const OpRecord* ReplayStream::getMatchParams() const
+{
+    return m_match_params ? &*m_match_params : nullptr;
+}
+
+const Instruction& ReplayStream::at(uint32_t i)
+{
+    static const Instruction s_unknown{};
+
+    auto& code = getChunk(i / m_header->index_interval)->program.code;
+    uint32_t ci = i % m_header->index_interval;
+    // the chunk can be short if the stream is corrupted
+    return ci < code.size() ? code[ci] : s_unknown;
+}
+
+const ReplayMatchPtr& ReplayStream::getMatch(uint32_t i)
+{
+    static const ReplayMatchPtr s_none;
+
+    auto& program = getChunk(i / m_header->index_interval)->program;
+    uint32_t ci = i % m_header->index_interval;
+    if (ci >= program.code.size())
+        return s_none;
+    auto& inst = program.code[ci];
+    if (inst.op != OpType::MouseMoveMatch && inst.op != OpType::WaitUntilMatch)
+        return s_none;
+    return program.matches[inst.match];
+}
+
+uint32_t ReplayStream::lowerBound(uint32_t time)
+{
+    if (!m_header)
+        return 0;
+
+    // the first record at or after time is in the last chunk that starts before time, or is the first record of the next one
+    auto index_end = m_index + m_header->index_count;
+    auto it = std::lower_bound(m_index, index_end, time,
+        [](const ReplayIndexEntry& e, uint32_t t) { return e.time < t; });
+    if (it == m_index)
+        return 0;
+    uint32_t id = uint32_t(it - m_index) - 1;
+
+    auto& code = getChunk(id)->program.code;
+    auto cit = std::lower_bound(code.begin(), code.end(), time,
+        [](const Instruction& inst, uint32_t t) { return inst.time < t; });
+    return std::min(id * m_header->index_interval + (uint32_t)std::distance(code.begin(), cit), size());
+}
+
+uint32_t ReplayStream::findNextMouseMoveMatch(uint32_t i)
+{
+    uint32_t n = size();
+    uint32_t interval = m_header ? m_header->index_interval : 1;
+    while (i < n) {
+        auto chunk = getChunk(i / interval, false);
+        if (!chunk)
+            break;
+        auto& program = chunk->program;
+        uint32_t ci = i % interval;
+        if (ci < program.next_mmatch.size() && program.next_mmatch[ci] < program.code.size())
+            return chunk->id * interval + program.next_mmatch[ci];
+        // not in this chunk. continue from the beginning of the next one.
+        i = (chunk->id + 1) * interval;
+    }
+    return n;
+}
+
+ReplayStream::ChunkPtr ReplayStream::decodeChunk(uint32_t id)
+{
+    auto ret = std::make_unique<Chunk>();
+    ret->id = id;
+
+    auto& entry = m_index[id];
+    uint32_t first = id * m_header->index_interval;
+    uint32_t count = std::min(m_header->index_interval, m_header->record_count - first);
+
+    std::vector<OpRecord> records;
+    auto records_begin = m_file.data() + m_header->records_offset;
+    auto records_end = records_begin + m_header->records_size;
+    if (entry.offset < m_header->records_size) {
+        ReplayDecoder dec{ records_begin + entry.offset, records_end };
+        int64_t time = entry.prev_time;
+        int2 abs_pos{ entry.abs_pos[0], entry.abs_pos[1] };
+        records.reserve(count);
+        for (uint32_t ri = 0; ri < count; ++ri) {
+            OpRecord rec;
+            if (!DecodeRecord(dec, time, abs_pos, m_strings, rec, m_templates))
+                break;
+            records.push_back(std::move(rec));
+        }
+    }
+    if (records.size() != count)
+        mrDbgPrint("*** ReplayStream: corrupted record stream (chunk %u) ***\n", id);
+
+    m_compiler.compile(records, ret->program, false);
+    return ret;
+}
+
+ReplayStream::Chunk* ReplayStream::getChunk(uint32_t id, bool wait)
+{
+    for (auto it = m_cache.begin(); it != m_cache.end(); ++it) {
+        if ((*it)->id == id) {
+            std::rotate(m_cache.begin(), it, it + 1);
+            return m_cache.front().get();
+        }
+    }
+
+    ChunkPtr chunk;
+    {
+        std::unique_lock l(m_mutex);
+        if (m_prefetch_id == id) {
+            if (!wait && !m_prefetched)
+                return nullptr;
+            m_cond.wait(l, [this]() { return m_prefetched != nullptr; });
+            chunk = std::move(m_prefetched);
+            m_prefetch_id = kNoChunk;
+        }
+    }
+    if (!chunk) {
+        if (!wait)
+            return nullptr;
+        // seek or the prefetch didn't keep up
+        chunk = decodeChunk(id);
+    }
+
+    m_cache.push_front(std::move(chunk));
+    if (m_cache.size() > kCacheChunks)
+        m_cache.pop_back();
+    requestPrefetch(id + 1);
+    return m_cache.front().get();
+}
+
+void ReplayStream::requestPrefetch(uint32_t id)
+{
+    if (id >= m_header->index_count)
+        return;
+    for (auto& c : m_cache)
+        if (c->id == id)
+            return;
+    {
+        std::unique_lock l(m_mutex);
+        if (m_prefetch_id == id)
+            return;
+        // thread is spawned on first use
+        if (!m_thread.joinable())
+            m_thread = std::thread([this]() { prefetchThread(); });
+        m_prefetch_id = id;
+        m_prefetch_pending = true;
+        m_prefetched.reset();
+    }
+    m_cond.notify_all();
+}
+
+void ReplayStream::prefetchThread()
+{
+    std::unique_lock l(m_mutex);
+    for (;;) {
+        m_cond.wait(l, [this]() { return m_closing || m_prefetch_pending; });
+        if (m_closing)
+            break;
+        uint32_t id = m_prefetch_id;
+        m_prefetch_pending = false;
+
+        l.unlock();
+        auto chunk = decodeChunk(id);
+        l.lock();
+
+        // discard if another chunk was requested meanwhile
+        if (m_prefetch_id == id) {
+            m_prefetched = std::move(chunk);
+            m_cond.notify_all();
+        }
+    }
+}
+
+} // namespace mr
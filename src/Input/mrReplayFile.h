@@ -0,0 +1,80 @@
+#pragma once
+#include "mrReplayProgram.h"
+
+namespace mr {
+
+struct ReplayHeader;
+struct ReplayIndexEntry;
+
+// reads a binary replay chunk by chunk through its time index, so memory usage doesn't grow with the length of the replay.
+// each chunk is compiled into ReplayProgram as it is decoded. the chunk after the one last accessed is decoded on a background thread.
+// accessors must be called from one thread.
+class ReplayStream
+{
+public:
+    // must return a new template for each call (IScreenMatcher::createTemplate() does)
+    using TemplateLoader = std::function<ITemplatePtr(const std::string& path)>;
+
+    ReplayStream();
+    ~ReplayStream();
+    ReplayStream(const ReplayStream&) = delete;
+    ReplayStream& operator=(const ReplayStream&) = delete;
+
+    // fails if path is not a binary replay with a time index. (text, version 1, or records not sorted by time)
+    bool open(const char* path);
+    void close();
+    // loads the templates in the string table. they are kept while the stream is open, so chunks decoded later
+    // (including re-decodes on seeks and Repeat) refer to them without loading again. call before accessing records.
+    void loadTemplates(const TemplateLoader& loader);
+
+    uint32_t size() const;
+    // the first MatchParams, which is held in the header and is not in the record sequence. null if none.
+    const OpRecord* getMatchParams() const;
+
+    // references are valid until kCacheChunks other chunks are accessed.
+    const Instruction& at(uint32_t i);
+    // operands of the MouseMoveMatch or WaitUntilMatch at i
+    const ReplayMatchPtr& getMatch(uint32_t i);
+    // index of the first record whose time is >= time. size() if none. decodes at most one chunk.
+    uint32_t lowerBound(uint32_t time);
+    // index of the first MouseMoveMatch at or after i. only looks in decoded chunks and never blocks.
+    // size() if not found.
+    uint32_t findNextMouseMoveMatch(uint32_t i);
+
+private:
+    struct Chunk
+    {
+        uint32_t id = 0;
+        ReplayProgram program; // indices are local to the chunk. Repeat targets are not resolved.
+    };
+    using ChunkPtr = std::unique_ptr<Chunk>;
+
+    static const size_t kCacheChunks = 3;
+    static const uint32_t kNoChunk = ~0u;
+
+    ChunkPtr decodeChunk(uint32_t id);
+    // if wait is false, returns null unless the chunk is cached or already prefetched.
+    Chunk* getChunk(uint32_t id, bool wait = true);
+    void requestPrefetch(uint32_t id);
+    void prefetchThread();
+
+    MappedFile m_file;
+    const ReplayHeader* m_header = nullptr;
+    const ReplayIndexEntry* m_index = nullptr; // m_header->index_count entries
+    std::vector<std::string> m_strings;
+    std::vector<ITemplatePtr> m_templates; // indexed by string index * number of match patterns + match pattern
+    std::optional<OpRecord> m_match_params;
+    ReplayCompiler m_compiler;
+
+    std::deque<ChunkPtr> m_cache; // most recently used first
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+    uint32_t m_prefetch_id = kNoChunk;
+    bool m_prefetch_pending = false;
+    ChunkPtr m_prefetched;
+    bool m_closing = false;
+};
+
+} // namespace mr
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "mrInternal.h"
+#include "mrReplayProgram.h"
+
+namespace mr {
+
+void ReplayProgram::clear()
+{
+    code.clear();
+    matches.clear();
+    next_mmatch.clear();
+}
+
+
+void ReplayCompiler::compile(std::span<const OpRecord> records, ReplayProgram& dst, bool resolve_jumps)
+{
+    dst.clear();
+    dst.code.reserve(records.size());
+    for (auto& rec : records) {
+        Instruction inst{};
+        inst.op = rec.type;
+        inst.time = rec.time;
+        switch (rec.type) {
+        case OpType::KeyDown:
+        case OpType::KeyUp:
+            inst.code = rec.data.key.code;
+            break;
+        case OpType::MouseDown:
+        case OpType::MouseUp:
+            inst.code = rec.data.mouse.button;
+            break;
+        case OpType::MouseMoveAbs:
+        case OpType::MouseMoveRel:
+            inst.pos = rec.data.mouse.pos;
+            break;
+        case OpType::SaveMousePos:
+        case OpType::LoadMousePos:
+            inst.slot = getSlot(rec.exdata.save_slot);
+            break;
+        case OpType::Wait:
+            inst.value = rec.exdata.wait_time;
+            break;
+        case OpType::TimeShift:
+            inst.value = rec.exdata.time_shift;
+            break;
+        case OpType::Repeat:
+            inst.value = rec.exdata.repeat_point;
+            if (resolve_jumps) {
+                auto it = std::lower_bound(records.begin(), records.end(), rec.exdata.repeat_point,
+                    [](const OpRecord& r, int t) { return (int64_t)r.time < t; });
+                inst.target = (uint32_t)std::distance(records.begin(), it);
+            }
+            break;
+        case OpType::MouseMoveMatch:
+        case OpType::WaitUntilMatch:
+        {
+            auto match = std::make_shared<ReplayMatch>();
+            match->threshold = rec.exdata.match_threshold;
+            for (auto& id : rec.exdata.templates)
+                if (id.tmpl)
+                    match->templates.push_back(id.tmpl);
+            inst.match = (uint32_t)dst.matches.size();
+            dst.matches.push_back(std::move(match));
+            break;
+        }
+        default:
+            // MatchParams is applied on load. kept as a no-op so that indices match records.
+            break;
+        }
+        dst.code.push_back(inst);
+    }
+
+    // for lookahead of MouseMoveMatch
+    uint32_t n = (uint32_t)dst.code.size();
+    dst.next_mmatch.resize(n);
+    uint32_t next = n;
+    for (uint32_t i = n; i-- > 0; ) {
+        if (dst.code[i].op == OpType::MouseMoveMatch)
+            next = i;
+        dst.next_mmatch[i] = next;
+    }
+}
+
+uint32_t ReplayCompiler::getSlotCount() const
+{
+    std::unique_lock l(m_mutex);
+    return (uint32_t)m_slots.size();
+}
+
+void ReplayCompiler::clear()
+{
+    std::unique_lock l(m_mutex);
+    m_slots.clear();
+}
+
+uint32_t ReplayCompiler::getSlot(int save_slot)
+{
+    std::unique_lock l(m_mutex);
+    auto it = m_slots.find(save_slot);
+    if (it != m_slots.end())
+        return it->second;
+    uint32_t ret = (uint32_t)m_slots.size();
+    m_slots[save_slot] = ret;
+    return ret;
+}
+
+} // namespace mr
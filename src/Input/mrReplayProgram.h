@@ -0,0 +1,59 @@
+#pragma once
+
+namespace mr {
+
+// operands of MouseMoveMatch and WaitUntilMatch. shared because in-flight matches can outlive a streamed chunk.
+struct ReplayMatch
+{
+    std::vector<ITemplatePtr> templates;
+    float threshold = 0.0f;
+};
+using ReplayMatchPtr = std::shared_ptr<ReplayMatch>;
+
+// compiled OpRecord. fixed size, trivially copyable, and needs no lookups to execute.
+struct Instruction
+{
+    static const uint32_t kUnresolved = ~0u;
+
+    OpType op = OpType::Unknown;
+    uint32_t time = 0; // in millisec
+    union
+    {
+        int2 pos;       // MouseMoveAbs, MouseMoveRel
+        int code;       // KeyDown, KeyUp, MouseDown, MouseUp (button)
+        int value;      // Wait, TimeShift, Repeat (repeat point)
+        uint32_t slot;  // SaveMousePos, LoadMousePos. dense index of the save slot
+        uint32_t match; // MouseMoveMatch, WaitUntilMatch. index in ReplayProgram::matches
+    };
+    uint32_t target = kUnresolved; // Repeat. index of the instruction to jump to
+};
+static_assert(sizeof(Instruction) == 20);
+
+struct ReplayProgram
+{
+    std::vector<Instruction> code;
+    std::vector<ReplayMatchPtr> matches;
+    std::vector<uint32_t> next_mmatch; // index of the next MouseMoveMatch at or after each instruction. code.size() if none
+
+    void clear();
+};
+
+// compiles records into ReplayProgram, one instruction per record.
+// templates must be loaded into the records beforehand. save slot numbers are mapped to the same dense indices
+// across compile() calls, which can be made from multiple threads.
+class ReplayCompiler
+{
+public:
+    // records must be sorted by time. if resolve_jumps, records are the whole replay and Repeat targets are resolved.
+    void compile(std::span<const OpRecord> records, ReplayProgram& dst, bool resolve_jumps);
+    uint32_t getSlotCount() const;
+    void clear();
+
+private:
+    uint32_t getSlot(int save_slot);
+
+    mutable std::mutex m_mutex;
+    std::map<int, uint32_t> m_slots;
+};
+
+} // namespace mr
@@ -243,8 +243,8 @@ void MarionetteApp::start()
         for (auto& kvp : m_keymap)
             kvp.second->update();
 
-        // possible better way:
-        // use GetMesssage() and Player & Recorder do their jobs in worker threads.
+        // players play back on their own threads. recorders are fed by the receiver, which runs on window messages.
+        // so this loop only pumps messages and polls state changes for the UI. 1ms is enough for that.
         mr::SleepMS(1);
 
         if (m_finished)
@@ -23,29 +23,29 @@ testRegisterInitializer(mr,
 
 mr::IReduceTotal::Result Total_Reference(mr::ITexture2DPtr src)
 {
-    auto reduce = [&src]<class T, class U>(T& ret, const U* data_, int pitch) {
-        auto size = src->getSize();
-        for (int y = 0; y < size.y; ++y) {
-            auto data = (const U*)((const byte*)data_ + (pitch * y));
-            for (auto v : std::span{ data, data + size.x })
+    auto reduce = []<class T, class U>(T& ret, mr::ImageView<const U> view) {
+        for (int y = 0; y < view.getSize().y; ++y) {
+            for (auto v : view[y])
                 ret += v;
         }
     };
 
     mr::IReduceTotal::Result ret{};
-    src->read([&](const void* data, int pitch) {
-        switch (src->getFormat()) {
-        case mr::TextureFormat::Ru8:
-            reduce(ret.valf, (const unorm8*)data, pitch);
-            break;
-        case mr::TextureFormat::Rf32:
-            reduce(ret.valf, (const float*)data, pitch);
-            break;
-        case mr::TextureFormat::Ri32:
-            reduce(ret.vali, (const uint32_t*)data, pitch);
-            break;
-        }
-        });
+    mr::MappedTexture mapped(src);
+    switch (src->getFormat()) {
+    case mr::TextureFormat::Ru8:
+        reduce(ret.valf, mapped.view<unorm8>());
+        break;
+    case mr::TextureFormat::Rf16:
+        reduce(ret.valf, mapped.view<mr::half>());
+        break;
+    case mr::TextureFormat::Rf32:
+        reduce(ret.valf, mapped.view<float>());
+        break;
+    case mr::TextureFormat::Ri32:
+        reduce(ret.vali, mapped.view<uint32_t>());
+        break;
+    }
     return ret;
 }
 
@@ -59,13 +59,10 @@ uint32_t CountBits_Reference(mr::ITexture2DPtr src)
     };
 
     uint32_t ret{};
-    src->read([&](const void* data_, int pitch) {
-        auto size = src->getSize();
-        for (int i = 0; i < size.y; ++i) {
-            auto data = (const uint32_t*)((const byte*)data_ + (pitch * i));
-            ret += process_line(data, mr::ceildiv(size.x, 32));
-        }
-        });
+    mr::MappedTexture mapped(src);
+    auto view = mapped.view<uint32_t>();
+    for (int i = 0; i < view.getSize().y; ++i)
+        ret += process_line(view.row(i), view.getSize().x);
     return ret;
 }
 
@@ -74,10 +71,10 @@ mr::IReduceMinMax::Result MinMax_Reference(mr::ITexture2DPtr src, int2 range = {
     if (range.x == 0)
         range = src->getSize();
 
-    auto reduce = [&src, range]<class T, class U>(T& vmin, T& vmax, int2& pmin, int2& pmax, const U * data_, int pitch) {
-        vmin = vmax = data_[0];
+    auto reduce = [range]<class T, class U>(T& vmin, T& vmax, int2& pmin, int2& pmax, mr::ImageView<const U> view) {
+        vmin = vmax = view.at(0, 0);
         for (int y = 0; y < range.y; ++y) {
-            auto data = (const U*)((const byte*)data_ + (pitch * y));
+            auto data = view[y];
             for (int x = 0; x < range.x; ++x) {
                 auto v = data[x];
                 if (v < vmin) {
@@ -93,19 +90,21 @@ mr::IReduceMinMax::Result MinMax_Reference(mr::ITexture2DPtr src, int2 range = {
     };
 
     mr::IReduceMinMax::Result ret{};
-    src->read([&](const void* data, int pitch) {
-        switch (src->getFormat()) {
-        case mr::TextureFormat::Ru8:
-            reduce(ret.valf_min, ret.valf_max, ret.pos_min, ret.pos_max, (const unorm8*)data, pitch);
-            break;
-        case mr::TextureFormat::Rf32:
-            reduce(ret.valf_min, ret.valf_max, ret.pos_min, ret.pos_max, (const float*)data, pitch);
-            break;
-        case mr::TextureFormat::Ri32:
-            reduce(ret.vali_min, ret.vali_max, ret.pos_min, ret.pos_max, (const uint32_t*)data, pitch);
-            break;
-        }
-        });
+    mr::MappedTexture mapped(src);
+    switch (src->getFormat()) {
+    case mr::TextureFormat::Ru8:
+        reduce(ret.valf_min, ret.valf_max, ret.pos_min, ret.pos_max, mapped.view<unorm8>());
+        break;
+    case mr::TextureFormat::Rf16:
+        reduce(ret.valf_min, ret.valf_max, ret.pos_min, ret.pos_max, mapped.view<mr::half>());
+        break;
+    case mr::TextureFormat::Rf32:
+        reduce(ret.valf_min, ret.valf_max, ret.pos_min, ret.pos_max, mapped.view<float>());
+        break;
+    case mr::TextureFormat::Ri32:
+        reduce(ret.vali_min, ret.vali_max, ret.pos_min, ret.pos_max, mapped.view<uint32_t>());
+        break;
+    }
     return ret;
 }
 
@@ -250,6 +249,141 @@ testCase(Filter)
     wait_async_ops();
 }
 
+testCase(FilterGraph)
+{
+    const float contour_radius = 1.0f;
+    const float binarize_threshold = 0.2f;
+    const int2 size{ 512, 256 };
+
+    auto gfx = mr::GetGfxInterface();
+    auto filter = mr::CreateFilterSet();
+    std::lock_guard<mr::IGfxInterface> lock(*gfx);
+
+    auto image = gfx->createTexture(size.x, size.y, mr::TextureFormat::RGBAu8);
+    DrawCircle(gfx, image, { 128, 128 }, 80.0f, 3.0f, { 1.0f, 1.0f, 1.0f, 1.0f });
+    DrawRect(image, { { 300, 40 }, { 150, 170 } }, 2.0f, { 0.5f, 0.8f, 0.2f, 1.0f });
+
+    auto gray = gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8);
+    auto contour = gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8);
+    auto bin_ref = gfx->createTexture(size.x, size.y, mr::TextureFormat::Binary);
+    auto bin_graph = gfx->createTexture(size.x, size.y, mr::TextureFormat::Binary);
+
+    // immediate
+    filter->grayscale(gray, image);
+    filter->contour(contour, gray, contour_radius);
+    filter->binarize(bin_ref, contour, binarize_threshold);
+
+    // graph. the temporary contour is not held by anyone, so contour & binarize are fused.
+    filter->beginGraph();
+    filter->grayscale(gray, image);
+    filter->contour(gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8), gray, contour_radius); // dead
+    {
+        auto tmp = gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8);
+        filter->contour(tmp, gray, contour_radius);
+        filter->binarize(bin_graph, tmp, binarize_threshold);
+    }
+    filter->endGraph();
+
+    uint32_t bits_ref = filter->countBits(bin_ref).get();
+    uint32_t bits_graph = filter->countBits(bin_graph).get();
+    testPrint("CountBits (immediate): %d\n", bits_ref);
+    testPrint("CountBits     (graph): %d\n", bits_graph);
+    testExpect(bits_ref != 0);
+    testExpect(bits_ref == bits_graph);
+    testExpect(CountBits_Reference(bin_graph) == bits_graph);
+}
+
+testCase(FilterRegion)
+{
+    const float contour_radius = 1.0f;
+    const float binarize_threshold = 0.2f;
+    const int2 size{ 512, 256 };
+    // x is multiple of 32. the circle is inside and the rect is outside, so the edges of the region are blank.
+    const Rect region{ { 32, 16 }, { 224, 224 } };
+
+    auto gfx = mr::GetGfxInterface();
+    auto filter = mr::CreateFilterSet();
+    std::lock_guard<mr::IGfxInterface> lock(*gfx);
+
+    auto image = gfx->createTexture(size.x, size.y, mr::TextureFormat::RGBAu8);
+    DrawCircle(gfx, image, { 128, 128 }, 80.0f, 3.0f, { 1.0f, 1.0f, 1.0f, 1.0f });
+    DrawRect(image, { { 300, 40 }, { 150, 170 } }, 2.0f, { 0.5f, 0.8f, 0.2f, 1.0f });
+
+    auto gray = gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8);
+    auto bin = gfx->createTexture(size.x, size.y, mr::TextureFormat::Binary);
+    filter->grayscale(gray, image);
+    filter->binarize(bin, gray, binarize_threshold);
+
+    // region only. buffers start blank, so anything written outside the region would show up in the totals.
+    std::vector<byte> blank(size.x * size.y, 0);
+    auto gray_r = gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8, blank.data(), size.x);
+    auto bin_r = gfx->createTexture(size.x, size.y, mr::TextureFormat::Binary);
+    auto contour_r = gfx->createTexture(size.x, size.y, mr::TextureFormat::Binary);
+    auto contour_ref = gfx->createTexture(size.x, size.y, mr::TextureFormat::Binary);
+    filter->beginGraph();
+    filter->grayscale(gray_r, image, { 0.0f, 1.0f }, {}, region);
+    filter->binarize(bin_r, gray_r, binarize_threshold, region);
+    {
+        // fused into a contour of the region
+        auto tmp = gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8);
+        filter->contour(tmp, gray_r, contour_radius, region);
+        filter->binarize(contour_r, tmp, binarize_threshold, region);
+    }
+    filter->endGraph();
+    {
+        auto tmp = gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8);
+        filter->contour(tmp, gray, contour_radius);
+        filter->binarize(contour_ref, tmp, binarize_threshold);
+    }
+
+    float total = filter->total(gray, region).get().valf;
+    float total_r = filter->total(gray_r).get().valf;
+    testPrint("Total (entire, region): %f, %f\n", total, total_r);
+    testExpect(total != 0.0f);
+    testExpect(std::abs(total - total_r) <= total * 1e-4f); // reduction order differs
+    testExpect(filter->countBits(bin, region).get() == filter->countBits(bin_r, region).get());
+    uint32_t bits = filter->countBits(contour_ref, region).get();
+    testExpect(bits != 0);
+    testExpect(bits == filter->countBits(contour_r, region).get());
+}
+
+testCase(BinaryLayout)
+{
+    // width that is not multiple of 32 nor 64
+    const int2 size{ 100, 8 };
+    std::vector<byte> data(size.x * size.y, 0xff);
+
+    auto gfx = mr::GetGfxInterface();
+    auto filter = mr::CreateFilterSet();
+    std::lock_guard<mr::IGfxInterface> lock(*gfx);
+
+    auto gray = gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8, data.data(), size.x);
+    auto bin = gfx->createTexture(size.x, size.y, mr::TextureFormat::Binary);
+    auto expanded = gfx->createTexture(size.x, size.y, mr::TextureFormat::Binary);
+    filter->binarize(bin, gray, 0.5f);
+    filter->expand(expanded, bin, 3.0f);
+
+    auto check = [&](mr::ITexture2DPtr tex) {
+        mr::MappedTexture mapped(tex);
+        auto view = mapped.view<uint64_t>();
+        testExpect(view.getSize().x == mr::GetBinaryRowWords(size.x));
+        testExpect(view.getSize().x % (mr::BinaryRowAlign / sizeof(uint64_t)) == 0);
+
+        // all pixels are set, and everything beyond the width is zero
+        bool ok = true;
+        for (int y = 0; y < view.getSize().y; ++y) {
+            auto row = view[y];
+            ok = ok && row[0] == ~0ull && row[1] == (1ull << (size.x - 64)) - 1;
+            for (size_t x = 2; x < row.size(); ++x)
+                ok = ok && row[x] == 0;
+        }
+        testExpect(ok);
+    };
+    check(bin);
+    check(expanded);
+    testExpect(filter->countBits(expanded).get() == uint32_t(size.x * size.y));
+}
+
 testCase(Lanczos3)
 {
     static const float PI = 3.14159265359f;
@@ -343,6 +477,70 @@ testCase(ScalingFilter)
 
 }
 
+testCase(ResourcePool)
+{
+    auto gfx = mr::GetGfxInterface();
+    const int2 size{ 256, 128 };
+    std::vector<byte> data(size.x * size.y, 0xff);
+
+    // released texture goes to the pool, and will be reused after the GPU passed a fence
+    gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8, data.data(), size.x);
+    gfx->sync();
+
+    // recycled textures must be cleared as well as new ones
+    auto stats = mr::GetResourcePoolStats();
+    auto tex = gfx->createTexture(size.x, size.y, mr::TextureFormat::Ru8);
+    testExpect(mr::GetResourcePoolStats().reused == stats.reused + 1);
+    bool cleared = true;
+    {
+        mr::MappedTexture mapped(tex);
+        auto view = mapped.view<uint8_t>();
+        for (int y = 0; y < view.getSize().y; ++y) {
+            for (auto v : view[y])
+                cleared = cleared && v == 0;
+        }
+    }
+    testExpect(cleared);
+
+    // allocation cost with pooling
+    test::TestScope("create & release 64 textures", [&]() {
+        for (int i = 0; i < 64; ++i)
+            gfx->createTexture(1920, 1080, mr::TextureFormat::Rf32);
+        gfx->sync();
+        }, 10);
+
+    // the pool is bounded by size, not by count
+    stats = mr::GetResourcePoolStats();
+    testPrint("reused: %llu, created: %llu, pooled: %zu bytes\n", stats.reused, stats.created, stats.pooled_bytes);
+    testExpect(stats.pooled_bytes <= stats.capacity);
+    testExpect(stats.reused > 0);
+}
+
+testCase(ImageWriter)
+{
+    auto gfx = mr::GetGfxInterface();
+    const int2 size{ 1920, 1080 };
+
+    auto image = gfx->createTexture(size.x, size.y, mr::TextureFormat::RGBAu8);
+    DrawCircle(gfx, image, { 960, 540 }, 400.0f, 8.0f, { 1.0f, 1.0f, 1.0f, 1.0f });
+
+    // queue is bounded. requests beyond it are dropped immediately and never block the caller.
+    std::vector<std::future<bool>> results;
+    test::TestScope("queue 64 saves", [&]() {
+        for (int i = 0; i < 64; ++i) {
+            char filename[256];
+            snprintf(filename, std::size(filename), "ImageWriter%02d.png", i);
+            results.push_back(image->saveAsync(filename));
+        }
+        });
+
+    int written = 0;
+    for (auto& r : results)
+        written += r.get() ? 1 : 0;
+    testPrint("written: %d, dropped: %d\n", written, int(results.size()) - written);
+    testExpect(written > 0);
+}
+
 testCase(ScreenCapture)
 {
     std::vector<std::future<bool>> async_ops;
@@ -380,11 +578,100 @@ testCase(ScreenCapture)
     wait_async_ops();
 }
 
+testCase(ImageSequenceCapture)
+{
+    // make a small sequence
+    std::filesystem::create_directories("ImageSequence");
+    {
+        std::ofstream manifest("ImageSequence/frames.txt");
+        std::vector<uint32_t> pixels(64 * 64);
+        for (int i = 0; i < 4; ++i) {
+            std::fill(pixels.begin(), pixels.end(), 0xff000000 | (i * 0x40));
+            char filename[256];
+            snprintf(filename, std::size(filename), "Frame%02d.png", i);
+            mr::SaveAsPNG((std::string("ImageSequence/") + filename).c_str(), 64, 64, mr::PixelFormat::RGBAu8, pixels.data());
+            manifest << (i + 1) * 1000000 << " " << filename << std::endl;
+        }
+    }
+
+    auto gfx = mr::GetGfxInterface();
+    auto scap = gfx->createScreenCaptureFromFiles("ImageSequence", false);
+    testExpect(scap != nullptr);
+    testExpect(scap->startCapture(mr::GetPrimaryMonitor()));
+
+    const int2 size{ 64, 64 };
+    for (int i = 0; i < 4; ++i) {
+        auto frame = scap->waitNextFrame();
+        testExpect(frame.surface != nullptr);
+        testExpect(frame.size == size);
+        testExpect(frame.present_time == (i + 1) * 1000000);
+    }
+    testExpect(!scap->isCapturing());
+    scap->stopCapture();
+}
+
+testCase(FrameArchive)
+{
+    const int w = 200, h = 130, n = 75;
+
+    // mostly static frames with small changes, and a few full changes
+    std::vector<std::vector<uint32_t>> frames;
+    std::mt19937 rand(0);
+    std::vector<uint32_t> pixels(w * h, 0xff203040);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < 50; ++j)
+            pixels[rand() % pixels.size()] = rand();
+        if (i % 20 == 5) {
+            for (auto& p : pixels)
+                p = rand() % 3;
+        }
+        frames.push_back(pixels);
+    }
+
+    {
+        auto writer = mr::CreateFrameArchiveWriter("FrameArchive.mrfa", w, h);
+        testExpect(writer != nullptr);
+        test::TestScope("write", [&]() {
+            for (int i = 0; i < n; ++i) {
+                while (!writer->addFrame(frames[i].data(), 0, 1000 + i * 10))
+                    mr::SleepMS(1);
+            }
+            writer->close();
+            });
+        testExpect(writer->getFrameCount() == n);
+    }
+
+    auto reader = mr::OpenFrameArchive("FrameArchive.mrfa");
+    testExpect(reader != nullptr);
+    testExpect(reader->getFrameCount() == n);
+    testExpect(reader->findFrame(999) == -1);
+    testExpect(reader->findFrame(1000) == 0);
+    testExpect(reader->findFrame(1015) == 1);
+
+    // sequential and random access
+    std::vector<uint32_t> buf(w * h);
+    test::TestScope("read sequential", [&]() {
+        for (int i = 0; i < n; ++i) {
+            testExpect(reader->readFrame(i, buf.data()));
+            testExpect(buf == frames[i]);
+        }
+        });
+    test::TestScope("read random", [&]() {
+        for (int i : { 40, 39, 74, 3, 31, 30, 29, 60, 0 }) {
+            testExpect(reader->readFrame(i, buf.data()));
+            testExpect(buf == frames[i]);
+        }
+        });
+    testPrint("    archive size: %llu bytes (raw: %llu bytes)\n",
+        (uint64_t)std::filesystem::file_size("FrameArchive.mrfa"), (uint64_t)n * w * h * 4);
+}
+
 
 
 class Window
 {
 public:
+    ~Window();
     bool open(int2 size, const TCHAR* title);
     int2 getSize() const;
     void processMessages();
@@ -418,6 +705,12 @@ int2 Window::getSize() const
     return m_size;
 }
 
+Window::~Window()
+{
+    if (m_hwnd)
+        ::DestroyWindow(m_hwnd);
+}
+
 bool Window::open(int2 size, const TCHAR* title)
 {
     m_size = size;
@@ -431,7 +724,8 @@ bool Window::open(int2 size, const TCHAR* title)
     wc.hInstance = ::GetModuleHandle(nullptr);
     wc.lpszClassName = class_name;
 
-    if (::RegisterClass(&wc) != 0) {
+    // the class stays registered after the first window
+    if (::RegisterClass(&wc) != 0 || ::GetLastError() == ERROR_CLASS_ALREADY_EXISTS) {
         RECT r{ 0, 0, (LONG)size.x, (LONG)size.y };
         ::AdjustWindowRect(&r, style, false);
         int w = r.right - r.left;
@@ -526,6 +820,29 @@ bool Window::draw(const unorm8x4* src)
     return draw(Rect{ {}, m_size }, src);
 }
 
+// red frame with transparent inside. what ScreenMatcher tests look for.
+static std::vector<unorm8x4> MakeFrameImage(int2 size)
+{
+    std::vector<unorm8x4> pixels(size.x * size.y);
+    auto* dst = pixels.data();
+    int bw = 2;
+    unorm8x4 border_color = { 1.0f, 0.0f, 0.0f, 1.0f };
+    unorm8x4 bg_color = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int y = 0; y < size.y; ++y) {
+        for (int x = 0; x < size.x; ++x) {
+            if (y < bw || y >= (size.y - bw) ||
+                x < bw || x >= (size.x - bw))
+            {
+                *dst++ = border_color;
+            }
+            else {
+                *dst++ = bg_color;
+            }
+        }
+    }
+    return pixels;
+}
+
 
 
 testCase(ScreenMatcher)
@@ -544,26 +861,7 @@ testCase(ScreenMatcher)
 
     Window window;
     window.open(tsize, L"Marionette Tracking");
-    {
-        std::vector<unorm8x4> pixels(tsize.x * tsize.y);
-        auto* dst = pixels.data();
-        int bw = 2;
-        unorm8x4 border_color = { 1.0f, 0.0f, 0.0f, 1.0f };
-        unorm8x4 bg_color = { 0.0f, 0.0f, 0.0f, 0.0f };
-        for (int y = 0; y < tsize.y; ++y) {
-            for (int x = 0; x < tsize.x; ++x) {
-                if (y < bw || y >= (tsize.y - bw) ||
-                    x < bw || x >= (tsize.x - bw))
-                {
-                    *dst++ = border_color;
-                }
-                else {
-                    *dst++ = bg_color;
-                }
-            }
-        }
-        window.draw(pixels.data());
-    }
+    window.draw(MakeFrameImage(tsize).data());
 
     ::Sleep(2000);
 
@@ -597,3 +895,77 @@ testCase(ScreenMatcher)
     }
 #endif
 }
+
+testCase(ReplayStreamingMatch)
+{
+    // MouseMoveMatch in a streamed replay. templates are loaded once for the stream and matches are prefetched across chunks.
+    const int2 tsize{ 96, 64 };
+    const int2 window_pos{ 200, 200 };
+    const char* template_path = "ReplayStreamingMatch.png";
+    auto pixels = MakeFrameImage(tsize);
+    {
+        auto gfx = mr::GetGfxInterface();
+        auto image = gfx->createTexture(tsize.x, tsize.y, mr::TextureFormat::RGBAu8, pixels.data(), tsize.x * (int)sizeof(unorm8x4));
+        testExpect(image && image->save(template_path));
+    }
+
+    Window window;
+    testExpect(window.open(tsize, L"Marionette Streaming Match"));
+    window.draw(pixels.data());
+    window.setPosition(window_pos);
+    window.processMessages();
+
+    // 4 chunks of moves to a fixed position, with a MouseMoveMatch every 500 records
+    const int num_records = 4000;
+    const int match_interval = 500;
+    const mr::int2 move_pos{ 1, 1 };
+    std::vector<mr::OpRecord> records;
+    {
+        mr::OpRecord rec;
+        rec.type = mr::OpType::MatchParams;
+        rec.exdata.match_params.contour_radius = 1.5f;
+        rec.exdata.match_params.expand_radius = 1.5f;
+        records.push_back(rec);
+    }
+    int num_matches = 0;
+    for (int i = 0; i < num_records; ++i) {
+        mr::OpRecord rec;
+        rec.time = i / 10; // 10 records per ms
+        if (i % match_interval == match_interval - 1) {
+            rec.type = mr::OpType::MouseMoveMatch;
+            rec.exdata.match_threshold = 0.3f;
+            rec.exdata.templates.push_back({ template_path });
+            ++num_matches;
+        }
+        else {
+            rec.type = mr::OpType::MouseMoveAbs;
+            rec.data.mouse.pos = move_pos;
+        }
+        records.push_back(rec);
+    }
+    testExpect(mr::SaveReplay("ReplayStreamingMatch.mrr", records));
+
+    auto sink = mr::CreateVirtualInputSink(num_records);
+    auto player = mr::CreatePlayer();
+    testExpect(player->load("ReplayStreamingMatch.mrr"));
+    player->setInputSink(sink);
+    testExpect(player->start());
+    while (player->update()) {
+        window.processMessages();
+        mr::SleepMS(1);
+    }
+
+    // a failed match stops playback, so all records are emitted only if every match succeeded
+    auto events = sink->getRecords();
+    testExpect(events.size() == num_records);
+    int2 center = window_pos + tsize / 2;
+    int found = 0;
+    for (auto& e : events) {
+        if (e.event.type != mr::InputEvent::Type::MouseMove || e.event.pos == move_pos)
+            continue;
+        ++found;
+        testPrint("match at (%d, %d)\n", e.event.pos.x, e.event.pos.y);
+        testExpect(std::abs(e.event.pos.x - center.x) <= 4 && std::abs(e.event.pos.y - center.y) <= 4);
+    }
+    testExpect(found == num_matches);
+}
@@ -20,3 +20,112 @@ testCase(String)
         ++n;
         });
 }
+
+testCase(TripleBuffer)
+{
+    struct Frame
+    {
+        uint64_t seq;
+        uint64_t check; // seq * 2. detects torn frames
+        mr::nanosec time;
+    };
+
+    const uint64_t num_frames = 100000;
+    mr::TripleBuffer<Frame> frames;
+
+    // synthetic producer. publishes as fast as possible and never waits for the consumer.
+    std::thread producer([&]() {
+        for (uint64_t i = 1; i <= num_frames; ++i) {
+            Frame& f = frames.back();
+            f.seq = i;
+            f.check = i * 2;
+            f.time = mr::NowNS();
+            frames.publish();
+        }
+        });
+
+    uint64_t last = 0, received = 0;
+    mr::nanosec total_latency = 0;
+    bool ok = true;
+    while (last < num_frames) {
+        if (frames.update()) {
+            const Frame& f = frames.front();
+            total_latency += mr::NowNS() - f.time;
+            ok = ok && f.check == f.seq * 2 && f.seq > last;
+            last = f.seq;
+            ++received;
+        }
+    }
+    producer.join();
+
+    testExpect(ok);
+    testExpect(last == num_frames);
+    testExpect(!frames.update());
+    testPrint("received %d of %d frames, average handoff latency: %.3fus\n",
+        (int)received, (int)num_frames, (double)total_latency / received / 1000.0);
+}
+
+testCase(Half)
+{
+    // rounding, denormals and overflow
+    testExpect(mr::half(1.0f).value == 0x3c00);
+    testExpect(mr::half(65504.0f).value == 0x7bff);
+    testExpect(mr::half(65520.0f).value == 0x7c00); // rounds to Inf
+    testExpect(mr::half(-0.0f).value == 0x8000);
+    testExpect(mr::half(5.9604645e-8f).value == 0x0001); // smallest denormal
+    testExpect(mr::half(1.0f + 1.0f / 2048.0f).value == 0x3c00); // tie rounds to even
+    testExpect(mr::half(1.0f + 3.0f / 2048.0f).value == 0x3c02);
+
+    // every half value survives round trip
+    bool roundtrip = true;
+    for (uint32_t i = 0; i < 0x10000; ++i) {
+        mr::half h;
+        h.value = uint16_t(i);
+        bool nan = (i & 0x7c00) == 0x7c00 && (i & 0x3ff) != 0;
+        if (!nan)
+            roundtrip = roundtrip && mr::half(h.to_float()).value == h.value;
+    }
+    testExpect(roundtrip);
+
+    // bulk conversion must match scalar one
+    const size_t n = 1024 * 1024 + 3;
+    std::vector<float> src(n), dst(n);
+    std::vector<mr::half> tmp(n);
+    for (size_t i = 0; i < n; ++i)
+        src[i] = float(i) * 0.001f - 500.0f;
+
+    test::TestScope("FloatToHalf", [&]() { mr::FloatToHalf(tmp.data(), src.data(), n); }, 10);
+    test::TestScope("HalfToFloat", [&]() { mr::HalfToFloat(dst.data(), tmp.data(), n); }, 10);
+
+    bool match = true;
+    for (size_t i = 0; i < n; ++i)
+        match = match && tmp[i].value == mr::half(src[i]).value && dst[i] == tmp[i].to_float();
+    testExpect(match);
+}
+
+testCase(VectorSIMD)
+{
+    using namespace mr;
+
+    // float4 / int4 / float4x4 operators go through SIMD overloads. compare with hand written scalar results.
+    float4 a{ 1.0f, 2.0f, 3.0f, 4.0f }, b{ 5.0f, 6.0f, 7.0f, 8.0f };
+    testExpect((a + b == float4{ 6.0f, 8.0f, 10.0f, 12.0f }));
+    testExpect((a * 2.0f - b == float4{ -3.0f, -2.0f, -1.0f, 0.0f }));
+    testExpect((near_equal(b / a, float4{ 5.0f, 3.0f, 7.0f / 3.0f, 2.0f })));
+    testExpect(dot(a, b) == 70.0f);
+    testExpect(max(-a, float4::zero()) == float4::zero());
+
+    int4 i{ 1, -2, 3, -4 }, j{ 5, 6, -7, 8 };
+    testExpect((i * j == int4{ 5, -12, -21, -32 }));
+    testExpect((min(i, j) == int4{ 1, -2, -7, -4 }));
+    testExpect((abs(i) == int4{ 1, 2, 3, 4 }));
+
+    float4x4 m = float4x4::identity();
+    m[3] = { 10.0f, 20.0f, 30.0f, 1.0f };
+    testExpect((m * float4{ 1.0f, 1.0f, 1.0f, 1.0f } == float4{ 11.0f, 21.0f, 31.0f, 1.0f }));
+    testExpect(((m * m)[3] == float4{ 20.0f, 40.0f, 60.0f, 1.0f }));
+
+    std::vector<float4> points(1024, float4{ 1.0f, 2.0f, 3.0f, 1.0f });
+    transform_array(points.data(), m, points.data(), points.size());
+    testExpect((points.back() == float4{ 11.0f, 22.0f, 33.0f, 1.0f }));
+}
@@ -0,0 +1,409 @@
+#include "pch.h"
+#include "Test.h"
+#include "Marionette.h"
+
+testCase(VirtualInputSink)
+{
+    // ring buffer keeps the newest events
+    auto sink = mr::CreateVirtualInputSink(4);
+    std::vector<mr::InputEvent> events;
+    for (int i = 0; i < 6; ++i)
+        events.push_back({ mr::InputEvent::Type::KeyDown, {}, i });
+    sink->emit(std::span<const mr::InputEvent>(events.data(), 2));
+    sink->emit(std::span<const mr::InputEvent>(events.data() + 2, 4));
+
+    auto records = sink->getRecords();
+    testExpect(sink->getCount() == 4 && sink->getTotalCount() == 6 && sink->getBatchCount() == 2);
+    testExpect(records.size() == 4 && records.front().event.code == 2 && records.back().event.code == 5);
+    testExpect(records.front().batch == 1);
+
+    sink->clear();
+    testExpect(sink->getCount() == 0 && sink->getRecords().empty());
+}
+
+testCase(PlayerTiming)
+{
+    // play a synthetic replay into a virtual sink and measure how late events are emitted.
+    const int num_events = 200;
+    const int interval = 5; // ms
+    const char* path = "PlayerTiming.txt";
+    {
+        std::ofstream ofs(path);
+        for (int i = 0; i < num_events; ++i) {
+            int t = i * interval;
+            // two records at the same time must be emitted in one batch
+            ofs << mr::Format("%d: MouseMoveAbs %d %d\n", t, 100 + i, 200);
+            ofs << mr::Format("%d: KeyDown %d\n", t, 65 + i % 26);
+        }
+    }
+
+    auto sink = mr::CreateVirtualInputSink(num_events * 2);
+    auto player = mr::CreatePlayer();
+    testExpect(player->load(path));
+    player->setInputSink(sink);
+    testExpect(player->start());
+    while (player->update())
+        mr::SleepMS(1);
+
+    auto records = sink->getRecords();
+    testExpect(records.size() == num_events * 2);
+    testExpect(sink->getBatchCount() <= num_events);
+
+    mr::nanosec max_late = 0, total_late = 0;
+    for (size_t i = 0; i < records.size(); i += 2) {
+        auto& move = records[i];
+        auto& key = records[i + 1];
+        testExpect(move.event.type == mr::InputEvent::Type::MouseMove && move.event.pos.x == 100 + int(i / 2));
+        testExpect(key.event.type == mr::InputEvent::Type::KeyDown && key.batch == move.batch);
+
+        mr::nanosec late = move.emit_time - move.event.time;
+        max_late = std::max(max_late, late);
+        total_late += late;
+    }
+    double average_ms = double(total_late) / num_events / 1000000.0;
+    double max_ms = double(max_late) / 1000000.0;
+    testPrint("%d events in %d batches. lateness: average %.3fms, max %.3fms\n",
+        (int)records.size(), (int)sink->getBatchCount(), average_ms, max_ms);
+    // generous bounds for loaded CI machines. a regression to per-tick polling or drifting timeline exceeds them.
+    testExpect(average_ms < 5.0);
+    testExpect(max_ms < 50.0);
+
+    player = nullptr;
+    std::filesystem::remove(path);
+}
+
+testCase(MousePathSimplifier)
+{
+    // 1000Hz mouse drawing a circle, with a click in the middle
+    std::vector<mr::OpRecord> input, output;
+    mr::MousePathSimplifier simplifier([&](const mr::OpRecord& rec) { output.push_back(rec); });
+
+    const float spatial = 2.0f;
+    const mr::millisec temporal = 50;
+    simplifier.setParams({ spatial, temporal });
+
+    mr::int2 last{ -1, -1 }, click_pos{};
+    for (uint32_t t = 0; t < 3000; ++t) {
+        float a = float(t) / 3000.0f * 6.2831853f;
+        mr::OpRecord rec;
+        rec.type = mr::OpType::MouseMoveAbs;
+        rec.time = t;
+        rec.data.mouse.pos = mr::int2{ int(500.0f + 300.0f * std::cos(a)), int(500.0f + 300.0f * std::sin(a)) };
+        if (rec.data.mouse.pos != last) {
+            last = rec.data.mouse.pos;
+            input.push_back(rec);
+            simplifier.push(rec);
+        }
+
+        if (t == 1500) {
+            click_pos = last;
+            mr::OpRecord click;
+            click.type = mr::OpType::MouseDown;
+            click.time = t;
+            click.data.mouse.button = 1;
+            simplifier.push(click);
+        }
+    }
+    simplifier.flush();
+
+    std::vector<mr::OpRecord> moves;
+    for (size_t i = 0; i < output.size(); ++i) {
+        if (output[i].type == mr::OpType::MouseMoveAbs) {
+            moves.push_back(output[i]);
+        }
+        else {
+            // cursor is exactly at the recorded position when clicked
+            testExpect(i > 0 && output[i - 1].data.mouse.pos == click_pos);
+        }
+    }
+    testExpect(moves.front().time == input.front().time && moves.back().time == input.back().time);
+
+    // the played cursor moves linearly between kept points. every input point is within the bound of
+    // where the cursor is at that time, and kept points are not too far apart.
+    auto max_error = [](const std::vector<mr::OpRecord>& input, const std::vector<mr::OpRecord>& moves) {
+        size_t kept = 0;
+        float ret = 0.0f;
+        for (auto& p : input) {
+            while (kept + 1 < moves.size() && moves[kept + 1].time <= p.time)
+                ++kept;
+            mr::int2 played = moves[kept].data.mouse.pos;
+            if (kept + 1 < moves.size()) {
+                auto& a = moves[kept];
+                auto& b = moves[kept + 1];
+                float t = float(p.time - a.time) / float(b.time - a.time);
+                played = mr::int2(mr::round(mr::lerp(mr::float2(a.data.mouse.pos), mr::float2(b.data.mouse.pos), t)));
+            }
+            ret = std::max(ret, mr::length(mr::float2(p.data.mouse.pos - played)));
+        }
+        return ret;
+    };
+    float max_dist = max_error(input, moves);
+    mr::millisec max_gap = 0;
+    for (size_t i = 1; i < moves.size(); ++i)
+        max_gap = std::max<mr::millisec>(max_gap, moves[i].time - moves[i - 1].time);
+    testExpect(max_dist <= spatial + 1e-3f);
+    testExpect(max_gap <= temporal);
+    testExpect(moves.size() * 10 < input.size());
+
+    testPrint("%d -> %d moves, max distance %.2fpx, max gap %dms\n",
+        (int)input.size(), (int)moves.size(), max_dist, (int)max_gap);
+
+    // fast straight drag (3px/ms). only the ends, splits by temporal and window ends are left
+    input.clear();
+    output.clear();
+    mr::MousePathSimplifier drag([&](const mr::OpRecord& rec) { output.push_back(rec); });
+    drag.setParams({ spatial, temporal });
+    for (uint32_t t = 0; t < 300; ++t) {
+        mr::OpRecord rec;
+        rec.type = mr::OpType::MouseMoveAbs;
+        rec.time = t;
+        rec.data.mouse.pos = mr::int2{ 100 + int(t) * 3, 200 + int(t) };
+        input.push_back(rec);
+        drag.push(rec);
+    }
+    drag.flush();
+    testExpect(max_error(input, output) <= spatial + 1e-3f);
+    testExpect(output.size() <= 300 / temporal + 3);
+    testPrint("straight drag: %d -> %d moves\n", (int)input.size(), (int)output.size());
+}
+
+testCase(ReplayFile)
+{
+    // text -> binary -> text must be lossless
+    std::vector<mr::OpRecord> records;
+    auto add = [&](const char* line) {
+        mr::OpRecord rec;
+        if (rec.fromText(line))
+            records.push_back(rec);
+    };
+    add("MatchParams Scale:0.50 CareDisplayScale:true ColorRange:{0.10,0.90} ContourRadius:1.00 ExpandRadius:2.00 BinarizeThreshold:0.30");
+    add("0: SaveMousePos 0");
+    add("10: KeyDown 65");
+    add("20: KeyUp 65");
+    add("100: MouseMoveMatch Threshold:0.20 Pattern:\"Binary\" Template:\"button.png\" Template:\"button2.png\"");
+    add("120: MouseDown 1");
+    add("130: MouseUp 1");
+    add("140: MouseMoveRel -5 3");
+    add("150: WaitUntilMatch Threshold:0.10 Pattern:\"Grayscale\" Template:\"button.png\"");
+    add("160: LoadMousePos 0");
+    add("170: Wait 500");
+    add("180: TimeShift -30");
+    for (int i = 0; i < 1000; ++i)
+        add(mr::Format("%d: MouseMoveAbs %d %d", 200 + i, 100 + i % 37, 300 - i % 11).c_str());
+    add("1300: Repeat 100");
+    add("0: Wait 0");
+
+    testExpect(mr::SaveReplay("ReplayFile.txt", records));
+    testExpect(mr::ConvertReplay("ReplayFile.txt", "ReplayFile.mrr"));
+    testExpect(mr::ConvertReplay("ReplayFile.mrr", "ReplayFile2.txt"));
+
+    std::vector<mr::OpRecord> text, binary;
+    testExpect(mr::LoadReplay("ReplayFile.txt", text));
+    testExpect(mr::LoadReplay("ReplayFile.mrr", binary));
+    testExpect(text.size() == records.size() && binary.size() == records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        testExpect(text[i].toText() == records[i].toText());
+        testExpect(binary[i].toText() == records[i].toText());
+    }
+
+    std::ifstream a("ReplayFile.txt", std::ios::binary), b("ReplayFile2.txt", std::ios::binary);
+    std::string sa{ std::istreambuf_iterator<char>(a), {} }, sb{ std::istreambuf_iterator<char>(b), {} };
+    testExpect(sa == sb);
+
+    auto text_size = std::filesystem::file_size("ReplayFile.txt");
+    auto binary_size = std::filesystem::file_size("ReplayFile.mrr");
+    testExpect(binary_size * 4 < text_size);
+    testPrint("%d records. text: %d bytes, binary: %d bytes\n", (int)records.size(), (int)text_size, (int)binary_size);
+
+    // CRLF text
+    {
+        std::ofstream ofs("ReplayFileCRLF.txt", std::ios::binary);
+        ofs << "10: KeyDown 65\r\n";
+        ofs << "100: MouseMoveMatch Threshold:0.20 Pattern:\"Binary\" Template:\"button.png\"\r\n";
+    }
+    std::vector<mr::OpRecord> crlf;
+    testExpect(mr::LoadReplay("ReplayFileCRLF.txt", crlf));
+    testExpect(crlf.size() == 2 && crlf[1].exdata.templates.size() == 1 && crlf[1].exdata.templates[0].path == "button.png");
+
+    // broken headers must be rejected, not trusted. see ReplayHeader for the offsets.
+    auto load_patched = [&](size_t offset, uint64_t value, size_t value_size) {
+        std::ifstream ifs("ReplayFile.mrr", std::ios::binary);
+        std::string data{ std::istreambuf_iterator<char>(ifs), {} };
+        memcpy(&data[offset], &value, value_size);
+        std::ofstream("ReplayFileBroken.mrr", std::ios::binary) << data;
+        std::vector<mr::OpRecord> tmp;
+        return mr::LoadReplay("ReplayFileBroken.mrr", tmp);
+    };
+    testExpect(!load_patched(8, ~0u, 4));       // record_count
+    testExpect(!load_patched(24, ~0ull, 8));    // records_size. records_offset + records_size overflows
+    testExpect(!load_patched(12, ~0u, 4));      // string_count
+}
+
+testCase(ReplayStreaming)
+{
+    // an indexed binary replay is played while being decoded chunk by chunk. must be identical to playing it from memory.
+    const int num_records = 20000;
+    const int loop = 2;
+    std::vector<mr::OpRecord> records;
+    for (int i = 0; i < num_records; ++i) {
+        mr::OpRecord rec;
+        rec.type = mr::OpType::MouseMoveAbs;
+        rec.time = i / 20; // 20 records per ms
+        rec.data.mouse.pos = { i, i % 1080 };
+        records.push_back(rec);
+    }
+    testExpect(mr::SaveReplay("ReplayStreaming.mrr", records));
+
+    {
+        // an index with too few entries for record_count must be rejected. see ReplayHeader for the offsets.
+        std::ifstream ifs("ReplayStreaming.mrr", std::ios::binary);
+        std::string data{ std::istreambuf_iterator<char>(ifs), {} };
+        uint32_t index_count = 1;
+        memcpy(&data[88], &index_count, sizeof(index_count));
+        std::ofstream("ReplayStreamingBroken.mrr", std::ios::binary) << data;
+        testExpect(!mr::CreatePlayer()->load("ReplayStreamingBroken.mrr"));
+    }
+
+    auto sink = mr::CreateVirtualInputSink(num_records * loop);
+    auto player = mr::CreatePlayer();
+    testExpect(player->load("ReplayStreaming.mrr"));
+    player->setInputSink(sink);
+    auto time_begin = mr::NowNS();
+    testExpect(player->start(loop));
+    while (player->update())
+        mr::SleepMS(1);
+    auto elapsed = mr::NowNS() - time_begin;
+
+    auto events = sink->getRecords();
+    testExpect(events.size() == num_records * loop);
+    for (size_t i = 0; i < events.size(); ++i)
+        testExpect(events[i].event.pos.x == int(i % num_records));
+    testPrint("%d records x %d loops in %.2fms\n", num_records, loop, double(elapsed) / 1000000.0);
+}
+
+testCase(ReplayStreamingRepeat)
+{
+    // Repeat in a streamed replay jumps through the time index into a chunk that is no longer cached
+    const int num_records = 6000; // 6 chunks
+    const int repeat_index = 1500; // not at a chunk boundary
+    std::vector<mr::OpRecord> records;
+    for (int i = 0; i < num_records; ++i) {
+        mr::OpRecord rec;
+        rec.type = mr::OpType::MouseMoveAbs;
+        rec.time = i / 20; // 20 records per ms
+        rec.data.mouse.pos = { i, 0 };
+        records.push_back(rec);
+    }
+    {
+        mr::OpRecord rec;
+        rec.type = mr::OpType::Repeat;
+        rec.time = num_records / 20;
+        rec.exdata.repeat_point = repeat_index / 20;
+        records.push_back(rec);
+    }
+    testExpect(mr::SaveReplay("ReplayStreamingRepeat.mrr", records));
+
+    const size_t num_events = num_records + (num_records - repeat_index) * 2;
+    auto sink = mr::CreateVirtualInputSink(num_events * 2);
+    auto player = mr::CreatePlayer();
+    testExpect(player->load("ReplayStreamingRepeat.mrr"));
+    player->setInputSink(sink);
+    testExpect(player->start());
+    // Repeat loops forever. a deadline in case playback stops or stalls
+    auto deadline = mr::NowMS() + 10000;
+    while (sink->getTotalCount() < num_events && player->isPlaying() && mr::NowMS() < deadline)
+        mr::SleepMS(1);
+    testExpect(sink->getTotalCount() >= num_events);
+    player->stop();
+
+    auto events = sink->getRecords();
+    testExpect(events.size() >= num_events);
+    bool ok = true;
+    for (size_t i = 0; i < num_events; ++i) {
+        int expected = i < num_records ? int(i) : repeat_index + int(i - num_records) % (num_records - repeat_index);
+        ok = ok && events[i].event.pos.x == expected;
+    }
+    testExpect(ok);
+}
+
+testCase(ReplayTextBenchmark)
+{
+    // lines/second of the text format
+    const int num_records = 1000000;
+    std::vector<mr::OpRecord> records;
+    records.reserve(num_records);
+    for (int i = 0; i < num_records; ++i) {
+        mr::OpRecord rec;
+        rec.time = i;
+        if (i % 100 == 0) {
+            rec.type = mr::OpType::MouseMoveMatch;
+            rec.exdata.templates.push_back({ "button.png" });
+        }
+        else if (i % 10 == 0) {
+            rec.type = i % 20 == 0 ? mr::OpType::KeyDown : mr::OpType::KeyUp;
+            rec.data.key.code = 65 + i % 26;
+        }
+        else {
+            rec.type = mr::OpType::MouseMoveAbs;
+            rec.data.mouse.pos = { i % 1920, i % 1080 };
+        }
+        records.push_back(rec);
+    }
+
+    const char* path = "ReplayTextBenchmark.txt";
+    auto t0 = mr::NowNS();
+    testExpect(mr::SaveReplayText(path, records));
+    auto t1 = mr::NowNS();
+    std::vector<mr::OpRecord> loaded;
+    testExpect(mr::LoadReplay(path, loaded));
+    auto t2 = mr::NowNS();
+
+    testExpect(loaded.size() == records.size());
+    for (int i = 0; i < num_records; i += 997)
+        testExpect(loaded[i].toText() == records[i].toText());
+
+    auto lines_per_sec = [&](mr::nanosec t) { return double(num_records) / (double(t) / 1000000000.0); };
+    testPrint("%d lines. save: %.2fms (%.0f lines/s), load: %.2fms (%.0f lines/s)\n", num_records,
+        double(t1 - t0) / 1000000.0, lines_per_sec(t1 - t0),
+        double(t2 - t1) / 1000000.0, lines_per_sec(t2 - t1));
+}
+
+testCase(PlayerProgram)
+{
+    // save slots and Repeat jumps through the compiled program
+    const char* path = "PlayerProgram.txt";
+    {
+        std::ofstream ofs(path);
+        ofs << "0: MouseMoveAbs 10 20\n";
+        ofs << "0: SaveMousePos 7\n";
+        ofs << "5: MouseMoveAbs 50 60\n";
+        ofs << "10: LoadMousePos 7\n";
+        ofs << "10: LoadMousePos 3\n"; // never saved. ignored
+        ofs << "20: KeyDown 65\n";
+        ofs << "25: KeyUp 65\n";
+        ofs << "30: Repeat 20\n";
+    }
+
+    const size_t num_events = 64;
+    auto sink = mr::CreateVirtualInputSink(num_events * 2);
+    auto player = mr::CreatePlayer();
+    testExpect(player->load(path));
+    player->setInputSink(sink);
+    testExpect(player->start());
+    // Repeat loops forever. a deadline in case playback stops or stalls
+    auto deadline = mr::NowMS() + 10000;
+    while (sink->getTotalCount() < num_events && player->isPlaying() && mr::NowMS() < deadline)
+        mr::SleepMS(1);
+    testExpect(sink->getTotalCount() >= num_events);
+    player->stop();
+
+    auto records = sink->getRecords();
+    testExpect(records.size() >= num_events);
+    using Type = mr::InputEvent::Type;
+    auto is_move = [&](size_t i, int x, int y) { return records[i].event.type == Type::MouseMove && records[i].event.pos == mr::int2{ x, y }; };
+    testExpect(is_move(0, 10, 20) && is_move(1, 50, 60) && is_move(2, 10, 20) && is_move(3, 10, 20));
+    // LoadMousePos moves twice to cross display boundaries. the moves must be separate emits (SendInput() calls).
+    testExpect(records[2].batch != records[3].batch);
+    for (size_t i = 4; i < num_events; ++i)
+        testExpect(records[i].event.type == ((i - 4) % 2 == 0 ? Type::KeyDown : Type::KeyUp));
+}
@@ -30,3 +30,4 @@
 #include <span>
 #include <bit>
 #include <ranges>
+#include <filesystem>
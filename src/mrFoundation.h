@@ -1,6 +1,7 @@
 #pragma once
 #include "Foundation/mrVector.h"
 #include "Foundation/mrRefPtr.h"
+#include "Foundation/mrTripleBuffer.h"
 
 #define mrAPI extern "C" __declspec(dllexport)
 
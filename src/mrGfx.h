@@ -21,6 +21,18 @@ struct Rect
     {
         return Rect{ pos - v, size + (v * 2), };
     }
+    Rect intersect(const Rect& v) const
+    {
+        int2 tl = clamp(pos, v.pos, v.pos + v.size);
+        int2 br = clamp(pos + size, v.pos, v.pos + v.size);
+        return Rect{ tl, br - tl };
+    }
+    Rect merge(const Rect& v) const
+    {
+        int2 tl = { std::min(pos.x, v.pos.x), std::min(pos.y, v.pos.y) };
+        int2 br = { std::max(pos.x + size.x, v.pos.x + v.size.x), std::max(pos.y + size.y, v.pos.y + v.size.y) };
+        return Rect{ tl, br - tl };
+    }
 
     bool operator==(const Rect& v) const { return pos == v.pos && size == v.size; }
     bool operator!=(const Rect& v) const { return pos != v.pos || size != v.size; }
@@ -51,6 +63,77 @@ enum class TextureFormat
     Binary,
 };
 
+// Binary layout:
+//  pixel x is bit (x % 64) of 64-bit word (x / 64). on GPU it is the same memory seen as uint32 (bit (x % 32) of word (x / 32)).
+//  rows are padded to a multiple of 64 bytes and always have at least one spare word of zeros after the last pixel.
+//  so bit matching loops can read word [i + 1] unconditionally and use aligned wide loads.
+constexpr int BinaryRowAlign = 64; // in bytes
+
+// number of 64-bit words in a row of Binary image, including padding
+inline int GetBinaryRowWords(int width)
+{
+    constexpr int align = BinaryRowAlign / sizeof(uint64_t);
+    return ceildiv(ceildiv(width, 64) + 1, align) * align;
+}
+
+// bytes of an element in a row. Binary packs 64 pixels in an uint64.
+inline int GetElementSize(TextureFormat f)
+{
+    switch (f) {
+    case TextureFormat::Ru8: return 1;
+    case TextureFormat::RGBAu8: return 4;
+    case TextureFormat::BGRAu8: return 4;
+    case TextureFormat::Rf16: return 2;
+    case TextureFormat::RGBAf16: return 8;
+    case TextureFormat::Rf32: return 4;
+    case TextureFormat::RGBAf32: return 16;
+    case TextureFormat::Ri32: return 4;
+    case TextureFormat::Binary: return 8;
+    default: return 0;
+    }
+}
+
+// bytes of a row. only Binary has padding (see above).
+inline int GetRowSize(TextureFormat f, int width)
+{
+    if (f == TextureFormat::Binary)
+        width = GetBinaryRowWords(width);
+    return width * GetElementSize(f);
+}
+
+
+// typed view of pitched image data. doesn't own the data.
+// T can be const. view[y] is a span of row y.
+template<class T>
+class ImageView
+{
+public:
+    using byte_type = std::conditional_t<std::is_const_v<T>, const uint8_t, uint8_t>;
+
+    ImageView() {}
+    ImageView(T* data, int2 size, int pitch) : m_data(data), m_size(size), m_pitch(pitch) {}
+    template<class U, std::enable_if_t<std::is_convertible_v<U*, T*>, bool> = true>
+    ImageView(const ImageView<U>& v) : m_data(v.data()), m_size(v.getSize()), m_pitch(v.getPitch()) {}
+
+    bool empty() const { return !m_data || m_size.x <= 0 || m_size.y <= 0; }
+    T* data() const { return m_data; }
+    int2 getSize() const { return m_size; }
+    int getPitch() const { return m_pitch; }
+
+    T* row(int y) const { return (T*)((byte_type*)m_data + (size_t(m_pitch) * y)); }
+    std::span<T> operator[](int y) const { return { row(y), size_t(m_size.x) }; }
+    T& at(int x, int y) const { return row(y)[x]; }
+
+    // sub region. no copy, pitch is kept.
+    ImageView subview(Rect r) const { return { row(r.pos.y) + r.pos.x, r.size, m_pitch }; }
+
+private:
+    T* m_data{};
+    int2 m_size{};
+    int m_pitch{};
+};
+
+
 class ITexture2D : public IObject
 {
 public:
@@ -62,10 +145,64 @@ public:
     virtual bool map(const ReadCallback& callback) = 0;
     virtual bool read(const ReadCallback& callback) = 0; // download() & map()
 
+    // map without callback. data is valid until unmap(). MappedTexture below does this in RAII style.
+    // wait: if false, returns false immediately while the GPU has not finished download() yet.
+    virtual bool map(const void*& data, int& pitch, bool wait = true) = 0;
+    virtual void unmap() = 0;
+
     virtual bool save(const std::string& path) = 0;
     virtual std::future<bool> saveAsync(const std::string& path) = 0;
 };
 
+
+// maps texture while alive. gives direct access to the mapped memory without callbacks or copies.
+//  MappedTexture mapped(tex);
+//  for (int y = 0; y < h; ++y) for (auto v : mapped.view<float>()[y]) ...
+class MappedTexture
+{
+public:
+    MappedTexture(ITexture2DPtr tex, bool download = true)
+        : m_texture(tex)
+    {
+        if (!m_texture)
+            return;
+        if (download)
+            m_texture->download();
+        if (!m_texture->map(m_data, m_pitch))
+            m_data = nullptr;
+    }
+
+    ~MappedTexture()
+    {
+        if (m_data)
+            m_texture->unmap();
+    }
+
+    MappedTexture(const MappedTexture&) = delete;
+    MappedTexture& operator=(const MappedTexture&) = delete;
+
+    bool valid() const { return m_data != nullptr; }
+    explicit operator bool() const { return valid(); }
+    const void* data() const { return m_data; }
+    int getPitch() const { return m_pitch; }
+
+    // T is the element type of a row (e.g. unorm8 for Ru8, uint64_t or uint32_t for Binary).
+    template<class T>
+    ImageView<const T> view() const
+    {
+        if (!m_data)
+            return {};
+        auto size = m_texture->getSize();
+        int width = GetRowSize(m_texture->getFormat(), size.x) / int(sizeof(T));
+        return { (const T*)m_data, { width, size.y }, m_pitch };
+    }
+
+private:
+    ITexture2DPtr m_texture;
+    const void* m_data{};
+    int m_pitch{};
+};
+
 class IBuffer : public IObject
 {
 public:
@@ -146,6 +283,7 @@ class ITransform : public IFilter
 {
 public:
     virtual void setSrcRegion(Rect v) = 0;
+    virtual void setDstRegion(Rect v) = 0; // only this region of dst is written. mapping to src is same as writing entire dst
     virtual void setColorRange(float2 v) = 0;
     virtual void setGrayscale(bool v) = 0;
     virtual void setFillAlpha(bool v) = 0;
@@ -163,6 +301,7 @@ class IBinarize : public IFilter
 {
 public:
     virtual void setThreshold(float v) = 0;
+    virtual void setRegion(Rect v) = 0; // only this region of dst is written. x is extended to 32 pixel boundaries
 };
 
 class IExpand : public IFilter
@@ -175,6 +314,8 @@ class IContour : public IFilter
 {
 public:
     virtual void setRadius(float v) = 0;
+    virtual void setThreshold(float v) = 0; // if dst is Binary, binarize in the same pass with this threshold (after quantizing to 8 bits, as Ru8)
+    virtual void setRegion(Rect v) = 0; // only this region of dst is written, and src is read only inside it. if dst is Binary, x is extended to 32 pixel boundaries
 };
 
 class ITemplateMatch : public IFilter
@@ -238,9 +379,13 @@ public:
 class IGfxInterface : public IObject
 {
 public:
+    // for Binary, rows of data must be GetRowSize(f, w) bytes (padding included)
     virtual ITexture2DPtr createTexture(int w, int h, TextureFormat f, const void* data = nullptr, int pitch = 0) = 0;
     virtual ITexture2DPtr createTextureFromFile(const char* path) = 0;
     virtual IScreenCapturePtr createScreenCapture() = 0;
+    // offline capture source. path: frame archive (*.mrfa) or image sequence. see mrImageSequenceCapture.cpp.
+    // realtime: pace frames by recorded present_time. otherwise every waitNextFrame() advances one frame.
+    virtual IScreenCapturePtr createScreenCaptureFromFiles(const char* path, bool realtime = true) = 0;
 
     // filters
 #define Body(CS) virtual I##CS##Ptr create##CS() = 0;
@@ -250,6 +395,8 @@ public:
     virtual void flush() = 0;
     virtual void sync(int timeout_ms = 1000) = 0;
 
+    // serializes use of the device between threads. recursive, so it can be held around calls that also take it
+    // (e.g. IScreenMatcher::match()).
     virtual void lock() = 0;
     virtual void unlock() = 0;
 
@@ -263,6 +410,16 @@ public:
 mrAPI IGfxInterface* GetGfxInterface_();
 mrDefShared(GetGfxInterface);
 
+// textures and buffers created without initial data are recycled. for tests & profiling.
+struct ResourcePoolStats
+{
+    uint64_t reused = 0;  // creations served from the pool
+    uint64_t created = 0; // creations that allocated new resources
+    size_t pooled_bytes = 0;
+    size_t capacity = 0;  // pooled_bytes never exceeds this
+};
+mrAPI ResourcePoolStats GetResourcePoolStats();
+
 
 using BitmapCallback = std::function<void(const void* data, int width, int height)>;
 mrAPI bool CaptureEntireScreen(const BitmapCallback& callback);
@@ -279,6 +436,42 @@ enum class PixelFormat
 mrAPI bool SaveAsPNG(const char* path, int w, int h, PixelFormat format, const void* data, int pitch = 0, bool flip_y = false);
 
 
+// compact archive of captured frames (*.mrfa). keyframes + XOR delta frames, indexed by time. see mrFrameArchive.cpp.
+mrDeclPtr(IFrameArchiveWriter);
+mrDeclPtr(IFrameArchiveReader);
+
+class IFrameArchiveWriter : public IObject
+{
+public:
+    // data: 4 bytes per pixel. time: in nanosec. frames must be added in time order.
+    // IRecorder writes times on the replay timeline: OpRecord::time * 1000000.
+    // frames are copied and compressed on a background thread. returns false if the frame is dropped.
+    virtual bool addFrame(const void* data, int pitch, uint64_t time) = 0;
+    virtual bool addFrame(ITexture2DPtr surface, uint64_t time) = 0; // surface->read() & addFrame()
+    virtual bool close() = 0; // flush queued frames and write index
+    virtual int getFrameCount() const = 0;
+    virtual int getDroppedFrameCount() const = 0;
+};
+mrAPI IFrameArchiveWriter* CreateFrameArchiveWriter_(const char* path, int width, int height, TextureFormat format);
+inline IFrameArchiveWriterPtr CreateFrameArchiveWriter(const char* path, int width, int height, TextureFormat format = TextureFormat::BGRAu8)
+{
+    return CreateFrameArchiveWriter_(path, width, height, format);
+}
+
+class IFrameArchiveReader : public IObject
+{
+public:
+    virtual int getFrameCount() const = 0;
+    virtual int2 getSize() const = 0;
+    virtual TextureFormat getFormat() const = 0;
+    virtual uint64_t getTime(int i) const = 0;
+    virtual int findFrame(uint64_t time) const = 0; // last frame at or before time. -1 if none
+    virtual bool readFrame(int i, void* dst, int pitch = 0) = 0;
+};
+mrAPI IFrameArchiveReader* OpenFrameArchive_(const char* path);
+inline IFrameArchiveReaderPtr OpenFrameArchive(const char* path) { return OpenFrameArchive_(path); }
+
+
 
 // high level API
 
@@ -294,12 +487,15 @@ public:
     inline  void copy(ITexture2DPtr dst, ITexture2DPtr src) { return copy(dst, src, Rect{}); }
     virtual void transform(ITexture2DPtr dst, ITexture2DPtr src, bool grayscale, bool filtering, Rect src_region = {}) = 0;
     inline  void transform(ITexture2DPtr dst, ITexture2DPtr src, bool grayscale) { return transform(dst, src, grayscale, dst->getSize().x != src->getSize().x); }
-    virtual void grayscale(ITexture2DPtr dst, ITexture2DPtr src, float2 range = { 0.0f, 1.0f }) = 0;
+    virtual void grayscale(ITexture2DPtr dst, ITexture2DPtr src, float2 range = { 0.0f, 1.0f }, Rect src_region = {}, Rect dst_region = {}) = 0;
 
     virtual void normalize(ITexture2DPtr dst, ITexture2DPtr src, float denom) = 0;
-    virtual void binarize(ITexture2DPtr dst, ITexture2DPtr src, float threshold) = 0;
-    virtual void contour(ITexture2DPtr dst, ITexture2DPtr src, float radius) = 0;
+    // dst_region: only this part of dst is written (for grayscale, src is mapped as if writing entire dst).
+    // contour reads src only inside it, as if it were the edges of the image.
+    virtual void binarize(ITexture2DPtr dst, ITexture2DPtr src, float threshold, Rect dst_region = {}) = 0;
+    virtual void contour(ITexture2DPtr dst, ITexture2DPtr src, float radius, Rect dst_region = {}) = 0;
     virtual void expand(ITexture2DPtr dst, ITexture2DPtr src, float radius) = 0;
+    // for grayscale, dst is sum of differences (Rf32) or mean of differences (Rf16). for binary, dst is Ri32.
     virtual void match(ITexture2DPtr dst, ITexture2DPtr src, ITexture2DPtr tmp, ITexture2DPtr mask = nullptr, Rect region = {}) = 0;
 
     virtual std::future<IReduceTotal::Result> total(ITexture2DPtr src, Rect region) = 0;
@@ -308,6 +504,12 @@ public:
     inline  std::future<IReduceCountBits::Result> countBits(ITexture2DPtr src, int2 region = {}) { return countBits(src, Rect{ int2{}, region }); }
     virtual std::future<IReduceMinMax::Result> minmax(ITexture2DPtr src, Rect region) = 0;
     inline  std::future<IReduceMinMax::Result> minmax(ITexture2DPtr src, int2 region = {}) { return minmax(src, Rect{ int2{}, region }); }
+
+    // graph mode. filters between beginGraph() and endGraph() are recorded and executed at endGraph().
+    // outputs nobody can read are skipped, and contour + binarize is fused.
+    // reductions execute recorded filters before themselves.
+    virtual void beginGraph() = 0;
+    virtual void endGraph() = 0;
 };
 mrAPI IFilterSet* CreateFilterSet_();
 inline IFilterSetPtr CreateFilterSet() { return CreateFilterSet_(); }
@@ -341,6 +543,8 @@ public:
     virtual ITexture2DPtr getImage() const = 0;
 };
 
+// createTemplate() and match() take the gfx lock (IGfxInterface::lock()) for their whole duration.
+// they can be called from any thread, with or without the lock held.
 class IScreenMatcher : public IObject
 {
 public:
@@ -365,13 +569,19 @@ public:
 #endif
     };
 
+    // returns a new template for each call. images are created once per path and shared between them,
+    // so each can have its own match pattern.
     virtual ITemplatePtr createTemplate(const char* path_to_png) = 0;
     virtual Result match(std::span<ITemplatePtr> tmpl, HMONITOR target) = 0;
     virtual Result match(std::span<ITemplatePtr> tmpl, HWND target) = 0;
+    // search only within region (screen coordinate). cheap if region is small, e.g. re-checking a previous result.
+    virtual Result match(std::span<ITemplatePtr> tmpl, Rect region) = 0;
     inline Result match(ITemplatePtr tmpl, HMONITOR target) { return match(MakeSpan(tmpl), target); }
     inline Result match(ITemplatePtr tmpl, HWND target) { return match(MakeSpan(tmpl), target); }
+    inline Result match(ITemplatePtr tmpl, Rect region) { return match(MakeSpan(tmpl), region); }
     inline Result match(std::vector<ITemplatePtr>& tmpl, HMONITOR target) { return match(MakeSpan(tmpl), target); }
     inline Result match(std::vector<ITemplatePtr>& tmpl, HWND target) { return match(MakeSpan(tmpl), target); }
+    inline Result match(std::vector<ITemplatePtr>& tmpl, Rect region) { return match(MakeSpan(tmpl), region); }
 };
 mrAPI IScreenMatcher* CreateScreenMatcher_(const IScreenMatcher::Params& params);
 inline IScreenMatcherPtr CreateScreenMatcher(const IScreenMatcher::Params& params = {}) { return CreateScreenMatcher_(params); }
@@ -1,4 +1,6 @@
 #pragma once
+#include <optional>
+#include <string_view>
 #include "mrFoundation.h"
 #include "mrGfx.h"
 
@@ -60,10 +62,59 @@ struct OpRecord
     } exdata{};
 
     std::string toText() const;
-    bool fromText(const std::string& v);
+    void toText(std::string& dst) const; // appends to dst
+    bool fromText(std::string_view v);
 };
 using OpRecordHandler = std::function<bool (OpRecord& rec)>;
 
+// online simplifier for recorded mouse paths. Player moves the cursor linearly between consecutive MouseMoveAbs records,
+// so moves are dropped while every dropped point is within the error bound of that line at its time.
+// pending moves are simplified in windows by Ramer-Douglas-Peucker with that error.
+// other records pass through and flush pending moves first, so the position at clicks and keys is exact.
+// Player doesn't interpolate across them, so the move after them is always kept.
+class MousePathSimplifier
+{
+public:
+    struct Params
+    {
+        float spatial = 1.0f;   // max distance in pixels between a dropped point and where the played cursor is at its time. 0 to keep all records
+        millisec temporal = 50; // max interval between kept points
+        int max_window = 256;   // max number of pending points. the last point of a window is always kept
+    };
+    using EmitHandler = std::function<void(const OpRecord& rec)>;
+
+    MousePathSimplifier(const EmitHandler& emit);
+    void setParams(const Params& v);
+    const Params& getParams() const;
+
+    // records must come in time order
+    void push(const OpRecord& rec);
+    void flush();
+
+    size_t getInputCount() const;
+    size_t getOutputCount() const;
+
+private:
+    void simplify();
+    void emit(const OpRecord& rec);
+
+    EmitHandler m_emit;
+    Params m_params;
+    std::optional<OpRecord> m_anchor; // last emitted MouseMoveAbs
+    std::vector<OpRecord> m_pending;
+    size_t m_input_count = 0;
+    size_t m_output_count = 0;
+};
+
+// replay files. text or binary (*.mrr). see mrReplayFile.cpp for the binary layout.
+// LoadReplay() detects the format by content and maps the file instead of reading it.
+// SaveReplay() writes binary if the extension is .mrr, text otherwise. conversions are lossless both ways.
+mrAPI bool LoadReplay(const char* path, std::vector<OpRecord>& dst);
+mrAPI bool SaveReplay(const char* path, std::span<const OpRecord> records);
+mrAPI bool SaveReplayText(const char* path, std::span<const OpRecord> records);
+mrAPI bool SaveReplayBinary(const char* path, std::span<const OpRecord> records);
+mrAPI bool ConvertReplay(const char* src_path, const char* dst_path);
+
 enum class MatchTarget
 {
     EntireScreen,
@@ -74,6 +125,59 @@ enum class MatchTarget
 mrDeclPtr(IRecorder);
 mrDeclPtr(IPlayer);
 
+
+// input event emitted by Player. positions are in screen coordinate.
+struct InputEvent
+{
+    enum class Type : int
+    {
+        MouseMove,
+        MouseDown,
+        MouseUp,
+        KeyDown,
+        KeyUp,
+    };
+    Type type{};
+    int2 pos{};     // MouseMove
+    int code{};     // mouse button (1: left, 2: right, 3: middle) or virtual key code
+    nanosec time{}; // scheduled time of the record that emitted this
+};
+
+// receives input events from Player.
+// emit() is called once per playback tick with all events due in that tick, in order.
+class IInputSink : public IObject
+{
+public:
+    virtual void emit(std::span<const InputEvent> events) = 0;
+};
+mrDeclPtr(IInputSink);
+
+// sends events to the OS with a single SendInput() per batch. Player uses this by default.
+mrAPI IInputSink* CreateSendInputSink_();
+mrDefShared(CreateSendInputSink);
+
+// keeps emitted events in a ring buffer instead of sending them. for tests and environments without a desktop.
+class IVirtualInputSink : public IInputSink
+{
+public:
+    struct Record
+    {
+        InputEvent event;
+        nanosec emit_time{}; // when emit() received it
+        uint32_t batch{};    // index of the emit() call
+    };
+
+    virtual size_t getCount() const = 0;        // number of records held. up to capacity
+    virtual size_t getTotalCount() const = 0;   // number of events emitted so far, including overwritten ones
+    virtual size_t getBatchCount() const = 0;
+    virtual std::vector<Record> getRecords() const = 0; // oldest first
+    virtual void clear() = 0;
+};
+mrDeclPtr(IVirtualInputSink);
+mrAPI IVirtualInputSink* CreateVirtualInputSink_(size_t capacity);
+inline IVirtualInputSinkPtr CreateVirtualInputSink(size_t capacity = 4096) { return CreateVirtualInputSink_(capacity); }
+
+
 class IRecorder : public IObject
 {
 public:
@@ -84,6 +188,11 @@ public:
     virtual bool save(const char* path) const = 0;
 
     virtual void addRecord(const OpRecord& rec) = 0;
+
+    // capture primary monitor while recording. save() after stop() writes frames to a frame archive next to the replay (*.mrfa).
+    virtual void setRecordFrames(bool v) = 0;
+    // mouse moves are simplified while recording. see MousePathSimplifier. spatial = 0 keeps all moves.
+    virtual void setMousePathTolerance(float spatial, millisec temporal) = 0;
 };
 mrAPI IRecorder* CreateRecorder_();
 mrDefShared(CreateRecorder);
@@ -98,6 +207,8 @@ public:
     virtual bool update() = 0;
     virtual bool load(const char* path) = 0;
     virtual void setMatchTarget(MatchTarget v) = 0;
+    // null to restore the default (SendInput). takes effect on next start().
+    virtual void setInputSink(IInputSinkPtr v) = 0;
 };
 mrAPI IPlayer* CreatePlayer_();
 mrDefShared(CreatePlayer);
@@ -21,6 +21,67 @@ inline bool get_flag(uint32_t src, T flag)
 }
 
 
+// name of the op in the replay text format
+const char* GetOpName(OpType v);
+
+inline bool IsWordChar(char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+inline bool IsSpaceChar(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f'; }
+
+// single pass ScanKVP without regex and allocations. body(std::string_view key, std::string_view value) receives views into s.
+// value is the content of {...}, a quoted string including the quotes, or up to the next space. returns the unscanned rest of s.
+template<class Body>
+inline std::string_view ForEachKVP(std::string_view s, Body&& body)
+{
+    size_t n = s.size(), i = 0, rest = 0;
+    for (;;) {
+        // find "key\s*:"
+        size_t key_begin = 0, key_end = 0;
+        bool found = false;
+        while (i < n && !found) {
+            if (!IsWordChar(s[i])) {
+                ++i;
+                continue;
+            }
+            key_begin = i;
+            while (i < n && IsWordChar(s[i]))
+                ++i;
+            key_end = i;
+            size_t j = i;
+            while (j < n && IsSpaceChar(s[j]))
+                ++j;
+            if (j < n && s[j] == ':') {
+                i = j + 1;
+                found = true;
+            }
+        }
+        if (!found)
+            return s.substr(rest);
+
+        while (i < n && IsSpaceChar(s[i]))
+            ++i;
+        size_t value_begin = i, value_end = i, close;
+        if (i < n && s[i] == '{' && (close = s.find('}', i + 1)) != std::string_view::npos && close > i + 1) {
+            value_begin = i + 1;
+            value_end = close;
+            i = close + 1;
+        }
+        else if (i < n && s[i] == '"' && (close = s.find('"', i + 1)) != std::string_view::npos) {
+            value_end = i = close + 1;
+        }
+        else {
+            while (i < n && s[i] != ' ')
+                ++i;
+            value_end = i;
+        }
+        if (value_begin == value_end)
+            return s.substr(i);
+
+        body(s.substr(key_begin, key_end - key_begin), s.substr(value_begin, value_end - value_begin));
+        rest = i;
+    }
+}
+
+
 class Timer
 {
 public:
@@ -42,6 +103,56 @@ private:
     std::string m_message;
 };
 
+// waits until NowNS() reaches a deadline with sub-millisecond accuracy.
+// sleeps on a high resolution waitable timer until shortly before the deadline, then spins the rest.
+class DeadlineTimer
+{
+public:
+    DeadlineTimer();
+    ~DeadlineTimer();
+    DeadlineTimer(const DeadlineTimer& v) = delete;
+    DeadlineTimer& operator=(const DeadlineTimer& v) = delete;
+
+    // returns false if canceled. returns true before the deadline if woken by wake().
+    bool waitUntil(nanosec deadline);
+    // makes the current or next waitUntil() return early. for the waiter to re-evaluate its deadline.
+    void wake();
+    // wakes up waitUntil(). stays canceled until reset().
+    void cancel();
+    void reset();
+
+private:
+    HANDLE m_timer{};
+    HANDLE m_cancel_event{};
+    HANDLE m_wake_event{};
+    nanosec m_spin_margin = 0;
+    bool m_raise_period = false; // fallback timer needs timeBeginPeriod(1)
+    std::atomic_bool m_canceled{ false };
+    std::atomic_bool m_woken{ false };
+};
+
+
+// read-only memory mapped file
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile();
+    MappedFile(const MappedFile& v) = delete;
+    MappedFile& operator=(const MappedFile& v) = delete;
+
+    bool open(const char* path);
+    void close();
+    const byte* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+    const byte* m_data = nullptr;
+    size_t m_size = 0;
+};
+
 
 template<class T>
 class RefCount : public T
@@ -80,6 +191,29 @@ protected:
     std::atomic_int m_ref{ 0 };
 };
 
+
+// host memory for pixel data. always 64 byte aligned.
+// large allocations are backed by large pages if the process is allowed to use them.
+void* AllocHostMemory(size_t size);
+void FreeHostMemory(void* p, size_t size);
+
+template<class T>
+class HostAllocator
+{
+public:
+    using value_type = T;
+
+    HostAllocator() {}
+    template<class U> HostAllocator(const HostAllocator<U>&) {}
+
+    T* allocate(size_t n) { return (T*)AllocHostMemory(sizeof(T) * n); }
+    void deallocate(T* p, size_t n) { FreeHostMemory(p, sizeof(T) * n); }
+
+    template<class U> bool operator==(const HostAllocator<U>&) const { return true; }
+    template<class U> bool operator!=(const HostAllocator<U>&) const { return false; }
+};
+template<class T> using HostVector = std::vector<T, HostAllocator<T>>;
+
 void AddInitializeHandler(const std::function<void()>& v);
 void AddFinalizeHandler(const std::function<void()>& v);
 
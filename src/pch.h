@@ -4,20 +4,27 @@
 #include <cstdint>
 #include <fstream>
 #include <string>
+#include <string_view>
+#include <charconv>
 #include <vector>
 #include <deque>
 #include <map>
+#include <set>
 #include <algorithm>
 #include <functional>
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <future>
 #include <tuple>
+#include <optional>
 #include <regex>
 #include <type_traits>
 #include <span>
 #include <ranges>
+#include <filesystem>
 
 #define NOMINMAX
 #include <windows.h>